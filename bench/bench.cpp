@@ -0,0 +1,352 @@
+/**
+ * Benchmarks of the extension's own overhead, with the stub FMOD backend and the fake SDK
+ * The extension is built as a whole into the benchmark, the natives and hooks are called the way SourceMod and the engine do
+ * The audio thread is stopped after loading, its updates are made by the benchmark between the game frames so the runs repeat
+ * Results go to stdout as JSON, to be diffed across versions
+ */
+
+#include "../extension.cpp"
+#include "bench_sdk.h"
+
+#include <ftw.h>
+#include <unistd.h>
+
+#ifndef AMM_BENCH_VERSION
+#define AMM_BENCH_VERSION "unknown"
+#endif
+
+#define BENCH_BANK_PARAMETER_COUNT 8
+#define BENCH_BANK_EVENT_COUNT 4
+#define BENCH_FLOOD_SETS_PER_FRAME 64
+#define BENCH_RESTORE_SAVE_COUNT 16 // More than MUSIC_STATE_CACHE_SIZE, so each restore reads the file
+
+struct BenchResult {
+    std::string name;
+    int iterations;
+    int operationsPerIteration;
+    std::vector<double> nanoseconds;
+};
+
+BenchPluginContext benchContext;
+std::vector<BenchResult> benchResults;
+
+/**
+ * Helper function to call a native with plain cells, params[0] being the count like in SourcePawn
+ */
+cell_t CallBenchNative(SPVM_NATIVE_FUNC native, std::initializer_list<cell_t> args) {
+    cell_t params[16];
+    params[0] = (cell_t) args.size();
+    int i = 1;
+    for (cell_t arg : args) {
+        params[i++] = arg;
+    }
+    return native(&benchContext, params);
+}
+
+/**
+ * A single frame of the game: the game frame hook, then an update of the audio thread
+ */
+void RunBenchFrame() {
+    gpGlobals->tickcount++;
+    gpGlobals->curtime += 0.015f;
+    g_AdaptiveMusicExt.Hook_GameFrame(true);
+    g_AdaptiveMusicExt.UpdateFMODWorker();
+}
+
+/**
+ * Time each iteration of a benchmark, after a tenth of them as a warmup
+ */
+template <typename Iteration>
+void RunBench(const char *name, int iterations, int operationsPerIteration, Iteration iteration) {
+    for (int i = 0; i < iterations / 10; i++) {
+        iteration(i);
+    }
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.operationsPerIteration = operationsPerIteration;
+    result.nanoseconds.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        iteration(i);
+        result.nanoseconds.push_back((double) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+    fprintf(stderr, "%s: %d iterations\n", name, iterations);
+    benchResults.push_back(std::move(result));
+}
+
+/**
+ * Helper function to write a file of the scratch game folder
+ */
+void WriteBenchFile(const std::string &path, const std::string &contents) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not write %s\n", path.c_str());
+        exit(1);
+    }
+    fwrite(contents.data(), 1, contents.length(), file);
+    fclose(file);
+}
+
+/**
+ * Write the stub banks the benchmarks load, in the format of bench/stub_fmod.cpp
+ */
+void WriteBenchBanks(const std::string &baseDir) {
+    g_AdaptiveMusicExt.filesystem->CreateDirHierarchy("sound/fmod/banks", "GAME");
+    g_AdaptiveMusicExt.filesystem->CreateDirHierarchy("save", "MOD");
+    std::string bank;
+    for (int i = 0; i < BENCH_BANK_EVENT_COUNT; i++) {
+        bank += "event event:/bench/music" + std::to_string(i) + " " + std::to_string(60000 + i * 1000) + "\n";
+    }
+    for (int i = 0; i < BENCH_BANK_PARAMETER_COUNT; i++) {
+        bank += "parameter bench_parameter" + std::to_string(i) + " 0 100 0\n";
+    }
+    bank += "bus bus:/music\nvca vca:/music\n";
+    WriteBenchFile(baseDir + "/sound/fmod/banks/bench.bank", bank);
+    WriteBenchFile(baseDir + "/sound/fmod/banks/bench.strings.bank", "");
+}
+
+/**
+ * Helper function to remove the scratch game folder
+ */
+int RemoveBenchFile(const char *path, const struct stat *pathStat, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+/**
+ * Helper function to print a duration in microseconds
+ */
+void PrintBenchMicroseconds(const char *key, double nanoseconds, bool last = false) {
+    printf("\"%s\": %.3f%s", key, nanoseconds / 1000.0, last ? "" : ", ");
+}
+
+void PrintBenchResults() {
+    printf("{\n");
+    printf("  \"version\": \"%s\",\n", AMM_BENCH_VERSION);
+    printf("  \"extension_version\": \"%s\",\n", SMEXT_CONF_VERSION);
+    printf("  \"benchmarks\": [\n");
+    for (size_t i = 0; i < benchResults.size(); i++) {
+        BenchResult &result = benchResults[i];
+        std::vector<double> sorted = result.nanoseconds;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double nanoseconds : sorted) {
+            total += nanoseconds;
+        }
+        size_t count = sorted.size();
+        printf("    {\"name\": \"%s\", \"iterations\": %d, \"operations_per_iteration\": %d, ", result.name.c_str(), result.iterations,
+               result.operationsPerIteration);
+        PrintBenchMicroseconds("mean_us", total / count);
+        PrintBenchMicroseconds("p50_us", sorted[count / 2]);
+        PrintBenchMicroseconds("p99_us", sorted[std::min(count - 1, (size_t) (count * 0.99))]);
+        PrintBenchMicroseconds("max_us", sorted[count - 1]);
+        printf("\"operations_per_second\": %.1f}%s\n", total > 0.0 ? count * result.operationsPerIteration / (total / 1e9) : 0.0,
+               i + 1 < benchResults.size() ? "," : "");
+    }
+    printf("  ],\n");
+    // The extension's own histograms, as amm_stats prints them
+    printf("  \"latency_histograms\": [\n");
+    std::vector<const FMODLatencyHistogram *> histograms;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.latencyHistogramsMutex);
+        for (const FMODLatencyHistogram *histogram : g_AdaptiveMusicExt.latencyHistograms) {
+            if (histogram->calls.load(std::memory_order_relaxed) > 0) {
+                histograms.push_back(histogram);
+            }
+        }
+    }
+    std::sort(histograms.begin(), histograms.end(), [](const FMODLatencyHistogram *a, const FMODLatencyHistogram *b) {
+        return strcmp(a->name, b->name) < 0;
+    });
+    for (size_t i = 0; i < histograms.size(); i++) {
+        const FMODLatencyHistogram &histogram = *histograms[i];
+        unsigned long long calls = histogram.calls.load(std::memory_order_relaxed);
+        printf("    {\"name\": \"%s\", \"calls\": %llu, ", histogram.name, calls);
+        PrintBenchMicroseconds("mean_us", (double) histogram.totalNanoseconds.load(std::memory_order_relaxed) / calls);
+        PrintBenchMicroseconds("p50_us", GetFMODLatencyPercentile(histogram, calls, 0.5) * 1000.0);
+        PrintBenchMicroseconds("p99_us", GetFMODLatencyPercentile(histogram, calls, 0.99) * 1000.0);
+        PrintBenchMicroseconds("max_us", (double) histogram.maxNanoseconds.load(std::memory_order_relaxed), true);
+        printf("}%s\n", i + 1 < histograms.size() ? "," : "");
+    }
+    printf("  ],\n");
+    printf("  \"console_messages\": %llu\n", GetBenchConsoleMessageCount());
+    printf("}\n");
+}
+
+int main(int argc, char **argv) {
+    int iterations = 2000;
+    bool verbose = false;
+    const char *filter = nullptr;
+    std::string baseDir = "/tmp/amm_bench." + std::to_string(getpid());
+    bool removeBaseDir = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            baseDir = argv[++i];
+            removeBaseDir = false;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations count] [--filter name] [--dir scratch directory] [--verbose]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 10) {
+        iterations = 10;
+    }
+
+    // LOADING, like SourceMod does it
+    StartBenchSDK(baseDir, verbose);
+    char error[256];
+    if (!g_AdaptiveMusicExt.SDK_OnMetamodLoad(g_SMAPI, error, sizeof(error), false) ||
+        !g_AdaptiveMusicExt.SDK_OnLoad(error, sizeof(error), false)) {
+        fprintf(stderr, "The extension failed to load\n");
+        return 1;
+    }
+    g_AdaptiveMusicExt.SDK_OnAllLoaded();
+    if (g_AdaptiveMusicExt.fmodStudioSystem == nullptr) {
+        fprintf(stderr, "The FMOD engine failed to start\n");
+        return 1;
+    }
+    g_AdaptiveMusicExt.StopFMODWorker();
+    WriteBenchBanks(baseDir);
+
+    SPVM_NATIVE_FUNC loadFMODBank = FindBenchNative("LoadFMODBank");
+    SPVM_NATIVE_FUNC getFMODEventHandle = FindBenchNative("GetFMODEventHandle");
+    SPVM_NATIVE_FUNC startFMODEventByHandle = FindBenchNative("StartFMODEventByHandle");
+    SPVM_NATIVE_FUNC stopFMODEventByHandle = FindBenchNative("StopFMODEventByHandle");
+    SPVM_NATIVE_FUNC getFMODParameterHandle = FindBenchNative("GetFMODParameterHandle");
+    SPVM_NATIVE_FUNC setFMODGlobalParameter = FindBenchNative("SetFMODGlobalParameter");
+    SPVM_NATIVE_FUNC setFMODGlobalParameterByHandle = FindBenchNative("SetFMODGlobalParameterByHandle");
+    SPVM_NATIVE_FUNC setFMODGlobalParametersByHandle = FindBenchNative("SetFMODGlobalParametersByHandle");
+
+    if (CallBenchNative(loadFMODBank, {benchContext.AllocString("bench"), 0}) != 0) {
+        fprintf(stderr, "The benchmark bank failed to load\n");
+        return 1;
+    }
+    RunBenchFrame();
+    cell_t eventHandles[BENCH_BANK_EVENT_COUNT];
+    for (int i = 0; i < BENCH_BANK_EVENT_COUNT; i++) {
+        std::string eventPath = "bench/music" + std::to_string(i);
+        eventHandles[i] = CallBenchNative(getFMODEventHandle, {benchContext.AllocString(eventPath.c_str())});
+    }
+    cell_t parameterHandles[BENCH_BANK_PARAMETER_COUNT];
+    cell_t parameterNames[BENCH_BANK_PARAMETER_COUNT];
+    for (int i = 0; i < BENCH_BANK_PARAMETER_COUNT; i++) {
+        std::string parameterName = "bench_parameter" + std::to_string(i);
+        parameterNames[i] = benchContext.AllocString(parameterName.c_str());
+        parameterHandles[i] = CallBenchNative(getFMODParameterHandle, {parameterNames[i]});
+    }
+    if (eventHandles[0] < 0 || parameterHandles[0] < 0) {
+        fprintf(stderr, "The benchmark bank's events and parameters were not found\n");
+        return 1;
+    }
+    cell_t parameterHandlesArray = benchContext.AllocCells(parameterHandles, BENCH_BANK_PARAMETER_COUNT);
+    cell_t valuesArray = benchContext.AllocCells(nullptr, BENCH_BANK_PARAMETER_COUNT);
+    CallBenchNative(startFMODEventByHandle, {eventHandles[0]});
+    RunBenchFrame();
+
+    auto selected = [filter](const char *name) {
+        return filter == nullptr || strstr(name, filter) != nullptr;
+    };
+
+    // PARAMETER SET FLOOD: a plugin setting parameters every frame
+    if (selected("parameter_set_flood")) {
+        RunBench("parameter_set_flood", iterations, BENCH_FLOOD_SETS_PER_FRAME, [&](int iteration) {
+            for (int i = 0; i < BENCH_FLOOD_SETS_PER_FRAME; i++) {
+                float value = (float) ((iteration + i) % 100);
+                CallBenchNative(setFMODGlobalParameterByHandle, {parameterHandles[i % BENCH_BANK_PARAMETER_COUNT], sp_ftoc(value)});
+            }
+            RunBenchFrame();
+        });
+    }
+    if (selected("parameter_set_flood_by_name")) {
+        RunBench("parameter_set_flood_by_name", iterations, BENCH_FLOOD_SETS_PER_FRAME, [&](int iteration) {
+            for (int i = 0; i < BENCH_FLOOD_SETS_PER_FRAME; i++) {
+                float value = (float) ((iteration + i) % 100);
+                CallBenchNative(setFMODGlobalParameter, {parameterNames[i % BENCH_BANK_PARAMETER_COUNT], sp_ftoc(value)});
+            }
+            RunBenchFrame();
+        });
+    }
+    if (selected("parameter_batch_set")) {
+        RunBench("parameter_batch_set", iterations, BENCH_FLOOD_SETS_PER_FRAME / BENCH_BANK_PARAMETER_COUNT, [&](int iteration) {
+            cell_t *values;
+            benchContext.LocalToPhysAddr(valuesArray, &values);
+            for (int i = 0; i < BENCH_FLOOD_SETS_PER_FRAME / BENCH_BANK_PARAMETER_COUNT; i++) {
+                for (int j = 0; j < BENCH_BANK_PARAMETER_COUNT; j++) {
+                    values[j] = sp_ftoc((float) ((iteration + i + j) % 100));
+                }
+                CallBenchNative(setFMODGlobalParametersByHandle, {parameterHandlesArray, valuesArray, BENCH_BANK_PARAMETER_COUNT});
+            }
+            RunBenchFrame();
+        });
+    }
+
+    // EVENT CHURN: starting and stopping the music, each change going through a frame
+    if (selected("event_churn")) {
+        RunBench("event_churn", iterations, 2, [&](int iteration) {
+            cell_t eventHandle = eventHandles[iteration % BENCH_BANK_EVENT_COUNT];
+            CallBenchNative(startFMODEventByHandle, {eventHandle});
+            RunBenchFrame();
+            CallBenchNative(stopFMODEventByHandle, {eventHandle});
+            RunBenchFrame();
+        });
+    }
+
+    // SAVES AND RESTORES: through the engine's hooks, with the music playing
+    CallBenchNative(startFMODEventByHandle, {eventHandles[0]});
+    RunBenchFrame();
+    int saveIterations = std::max(10, iterations / 10);
+    if (selected("music_state_round_trip")) {
+        SetBenchSaveFileName("save/bench.sav");
+        RunBench("music_state_round_trip", saveIterations, 1, [&](int iteration) {
+            Hook_SaveGlobalState(nullptr);
+            // Waits for the file to be written
+            Hook_Restore(nullptr, false);
+            RunBenchFrame();
+        });
+    }
+    if (selected("music_state_restore_cached")) {
+        SetBenchSaveFileName("save/bench_cached.sav");
+        Hook_SaveGlobalState(nullptr);
+        RunBench("music_state_restore_cached", saveIterations, 1, [&](int iteration) {
+            Hook_Restore(nullptr, false);
+            RunBenchFrame();
+        });
+    }
+    if (selected("music_state_restore_uncached")) {
+        for (int i = 0; i < BENCH_RESTORE_SAVE_COUNT; i++) {
+            std::string saveName = "save/bench_uncached" + std::to_string(i) + ".sav";
+            SetBenchSaveFileName(saveName.c_str());
+            Hook_SaveGlobalState(nullptr);
+            WaitForMusicStateWrites(replaceSavWithMusicState(saveName));
+        }
+        RunBench("music_state_restore_uncached", saveIterations, 1, [&](int iteration) {
+            std::string saveName = "save/bench_uncached" + std::to_string(iteration % BENCH_RESTORE_SAVE_COUNT) + ".sav";
+            SetBenchSaveFileName(saveName.c_str());
+            Hook_Restore(nullptr, false);
+            RunBenchFrame();
+        });
+    }
+    if (selected("autosave_rotation")) {
+        SetBenchSaveFileName("save/autosave.sav");
+        RunBench("autosave_rotation", saveIterations, 1, [&](int iteration) {
+            Hook_SaveGlobalState(nullptr);
+            // Until the slot and the manifest are on disk
+            WaitForMusicStateWrites("autosave.musicstate.sav");
+        });
+    }
+
+    // UNLOADING, like SourceMod does it
+    g_AdaptiveMusicExt.SDK_OnUnload();
+    g_AdaptiveMusicExt.SDK_OnMetamodUnload(error, sizeof(error));
+    PrintBenchResults();
+    if (removeBaseDir) {
+        nftw(baseDir.c_str(), RemoveBenchFile, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * What the benchmark needs from the fake SourceMod, Metamod and engine of bench/stub_sdk.cpp
+ */
+
+#ifndef _INCLUDE_AMM_BENCH_SDK_H_
+#define _INCLUDE_AMM_BENCH_SDK_H_
+
+#include "smsdk_ext.h"
+#include <string>
+
+/**
+ * Plugin memory for the natives: strings and arrays are copied in, the natives get their local addresses
+ * Like SourcePawn, local addresses are byte offsets into the plugin's memory
+ */
+class BenchPluginContext : public IPluginContext {
+public:
+    BenchPluginContext();
+
+    int LocalToString(cell_t local_addr, char **addr) override;
+    int LocalToPhysAddr(cell_t local_addr, cell_t **phys_addr) override;
+    int StringToLocal(cell_t local_addr, size_t bytes, const char *source) override;
+
+    cell_t AllocString(const char *value);
+    cell_t AllocCells(const cell_t *values, int count);
+    void Reset();
+
+private:
+    std::vector<char> memory;
+    size_t used;
+};
+
+/**
+ * Set up the fake SourceMod, Metamod and engine, with the game folder in a scratch directory
+ * @param baseDir The scratch directory, created if needed
+ * @param verbose Print the extension's console messages instead of just counting them
+ */
+void StartBenchSDK(const std::string &baseDir, bool verbose);
+
+/**
+ * Find a native registered by the extension
+ * @return The native, aborts the benchmark if the extension didn't register it
+ */
+SPVM_NATIVE_FUNC FindBenchNative(const char *name);
+
+/**
+ * Set the name the engine gives to the save being written or loaded
+ */
+void SetBenchSaveFileName(const char *saveFileName);
+
+/**
+ * @return The number of console messages printed by the extension
+ */
+unsigned long long GetBenchConsoleMessageCount();
+
+#endif // _INCLUDE_AMM_BENCH_SDK_H_
@@ -0,0 +1,118 @@
+/**
+ * Benchmark stand-in for the HL2SDK ConVar and ConCommand header
+ * The ConVars and commands are kept in a list like tier1 does, ConVar_Register hands them to the accessor
+ */
+
+#ifndef _INCLUDE_AMM_BENCH_CONVAR_H_
+#define _INCLUDE_AMM_BENCH_CONVAR_H_
+
+#include <string>
+#include <vector>
+
+#define FCVAR_NONE 0
+#define FCVAR_ARCHIVE (1 << 7)
+
+class IConVar {
+public:
+    virtual const char *GetName() const = 0;
+};
+
+typedef void (*FnChangeCallback_t)(IConVar *var, const char *pOldValue, float flOldValue);
+
+class ConCommandBase {
+public:
+    ConCommandBase(const char *pName, const char *pHelpString, int flags);
+    virtual ~ConCommandBase() {}
+
+    virtual bool IsCommand() const = 0;
+
+    const char *GetName() const { return m_pszName; }
+
+    const char *GetHelpText() const { return m_pszHelpString; }
+
+    static ConCommandBase *Find(const char *pName);
+
+    ConCommandBase *m_pNext;
+    static ConCommandBase *s_pConCommandBases;
+
+protected:
+    const char *m_pszName;
+    const char *m_pszHelpString;
+    int m_nFlags;
+};
+
+class CCommand {
+public:
+    CCommand(const std::vector<std::string> &args) : m_Args(args) {}
+
+    int ArgC() const { return (int) m_Args.size(); }
+
+    const char *Arg(int nIndex) const { return nIndex < ArgC() ? m_Args[nIndex].c_str() : ""; }
+
+    const char *operator[](int nIndex) const { return Arg(nIndex); }
+
+private:
+    std::vector<std::string> m_Args;
+};
+
+typedef void (*FnCommandCallback_t)(const CCommand &command);
+
+class ConCommand : public ConCommandBase {
+public:
+    ConCommand(const char *pName, FnCommandCallback_t callback, const char *pHelpString = 0, int flags = 0, void *completionFunc = 0);
+
+    virtual bool IsCommand() const { return true; }
+
+    void Dispatch(const CCommand &command) { m_fnCommandCallback(command); }
+
+private:
+    FnCommandCallback_t m_fnCommandCallback;
+};
+
+class ConVar : public ConCommandBase, public IConVar {
+public:
+    ConVar(const char *pName, const char *pDefaultValue, int flags = 0, const char *pHelpString = 0);
+    ConVar(const char *pName, const char *pDefaultValue, int flags, const char *pHelpString, bool bMin, float fMin, bool bMax, float fMax,
+           FnChangeCallback_t callback = 0);
+
+    virtual bool IsCommand() const { return false; }
+
+    virtual const char *GetName() const { return m_pszName; }
+
+    float GetFloat() const { return m_fValue; }
+
+    int GetInt() const { return m_nValue; }
+
+    bool GetBool() const { return m_nValue != 0; }
+
+    const char *GetString() const { return m_StringValue.c_str(); }
+
+    void SetValue(const char *value);
+    void SetValue(float value);
+    void SetValue(int value);
+
+private:
+    std::string m_StringValue;
+    float m_fValue;
+    int m_nValue;
+    bool m_bHasMin;
+    float m_fMinVal;
+    bool m_bHasMax;
+    float m_fMaxVal;
+    FnChangeCallback_t m_fnChangeCallback;
+};
+
+class IConCommandBaseAccessor {
+public:
+    virtual bool RegisterConCommandBase(ConCommandBase *pVar) = 0;
+};
+
+void ConVar_Register(int nCVarFlag = 0, IConCommandBaseAccessor *pAccessor = 0);
+void ConVar_Unregister();
+
+#define CON_COMMAND(name, description) \
+    static void name(const CCommand &args); \
+    static ConCommand name##_command(#name, name, description); \
+    static void name(const CCommand &args)
+
+#endif // _INCLUDE_AMM_BENCH_CONVAR_H_
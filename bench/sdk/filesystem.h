@@ -0,0 +1,36 @@
+/**
+ * Benchmark stand-in for the HL2SDK file system header
+ * Only declares what the extension uses, implemented by the fake file system of bench/stub_sdk.cpp
+ */
+
+#ifndef _INCLUDE_AMM_BENCH_FILESYSTEM_H_
+#define _INCLUDE_AMM_BENCH_FILESYSTEM_H_
+
+typedef void *FileHandle_t;
+
+#define FILESYSTEM_INTERFACE_VERSION "VFileSystem022"
+
+enum FileSystemSeek_t {
+    FILESYSTEM_SEEK_HEAD = 0,
+    FILESYSTEM_SEEK_CURRENT,
+    FILESYSTEM_SEEK_TAIL
+};
+
+class IFileSystem {
+public:
+    virtual FileHandle_t Open(const char *pFileName, const char *pOptions, const char *pathID = 0) = 0;
+    virtual void Close(FileHandle_t file) = 0;
+    virtual int Read(void *pOutput, int size, FileHandle_t file) = 0;
+    virtual int Write(void const *pInput, int size, FileHandle_t file) = 0;
+    virtual void Seek(FileHandle_t file, int pos, FileSystemSeek_t seekType) = 0;
+    virtual unsigned int Size(FileHandle_t file) = 0;
+    virtual unsigned int Size(const char *pFileName, const char *pPathID = 0) = 0;
+    virtual void Flush(FileHandle_t file) = 0;
+    virtual bool FileExists(const char *pFileName, const char *pPathID = 0) = 0;
+    virtual void RemoveFile(char const *pRelativePath, const char *pathID = 0) = 0;
+    virtual long GetFileTime(const char *pFileName, const char *pPathID = 0) = 0;
+    virtual char *ReadLine(char *pOutput, int maxChars, FileHandle_t file) = 0;
+    virtual void CreateDirHierarchy(const char *path, const char *pathID = 0) = 0;
+};
+
+#endif // _INCLUDE_AMM_BENCH_FILESYSTEM_H_
@@ -0,0 +1,21 @@
+/**
+ * Benchmark stand-in for the HL2SDK ConVar system header
+ */
+
+#ifndef _INCLUDE_AMM_BENCH_ICVAR_H_
+#define _INCLUDE_AMM_BENCH_ICVAR_H_
+
+#include "convar.h"
+
+#define CVAR_INTERFACE_VERSION "VEngineCvar004"
+
+class ICvar {
+public:
+    virtual ConVar *FindVar(const char *var_name) = 0;
+    virtual void InstallGlobalChangeCallback(FnChangeCallback_t callback) = 0;
+    virtual void RemoveGlobalChangeCallback(FnChangeCallback_t callback) = 0;
+};
+
+extern ICvar *g_pCVar;
+
+#endif // _INCLUDE_AMM_BENCH_ICVAR_H_
@@ -0,0 +1,174 @@
+/**
+ * Benchmark stand-in for the SourceMod SDK and Metamod:Source headers
+ * Only declares what the extension uses, implemented by bench/stub_sdk.cpp
+ */
+
+#ifndef _INCLUDE_AMM_BENCH_SMSDK_EXT_H_
+#define _INCLUDE_AMM_BENCH_SMSDK_EXT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "smsdk_config.h"
+
+typedef int32_t cell_t;
+
+inline float sp_ctof(cell_t value) {
+    float result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+inline cell_t sp_ftoc(float value) {
+    cell_t result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+class IPluginContext {
+public:
+    virtual int LocalToString(cell_t local_addr, char **addr) = 0;
+    virtual int LocalToPhysAddr(cell_t local_addr, cell_t **phys_addr) = 0;
+    virtual int StringToLocal(cell_t local_addr, size_t bytes, const char *source) = 0;
+};
+
+typedef cell_t (*SPVM_NATIVE_FUNC)(IPluginContext *, const cell_t *);
+
+typedef struct sp_nativeinfo_s {
+    const char *name;
+    SPVM_NATIVE_FUNC func;
+} sp_nativeinfo_t;
+
+namespace SourceMod {
+    class IExtension {
+    };
+
+    class IShareSys {
+    public:
+        virtual void AddNatives(IExtension *myself, const sp_nativeinfo_t *natives) = 0;
+    };
+
+    class ISourceMod {
+    public:
+        virtual void LogMessage(IExtension *myself, const char *message, ...) = 0;
+    };
+
+    enum ExecType {
+        ET_Ignore = 0,
+        ET_Single,
+        ET_Event,
+        ET_Hook
+    };
+
+    enum ParamType {
+        Param_Any = 0,
+        Param_Cell = (1 << 1),
+        Param_Float = (2 << 1),
+        Param_String = (3 << 1) | 1,
+        Param_Array = (4 << 1) | 1
+    };
+
+    class IForward {
+    public:
+        virtual int Execute(cell_t *result, void *filter = NULL) = 0;
+        virtual int PushCell(cell_t cell) = 0;
+        virtual int PushFloat(float number) = 0;
+        virtual int PushString(const char *string) = 0;
+    };
+
+    class IForwardManager {
+    public:
+        virtual IForward *CreateForward(const char *name, ExecType et, unsigned int num_params, const ParamType *types, ...) = 0;
+        virtual void ReleaseForward(IForward *forward) = 0;
+    };
+}
+
+using namespace SourceMod;
+
+namespace SourceHook {
+}
+
+class ConCommandBase;
+
+typedef void *(*CreateInterfaceFn)(const char *name, int *returnCode);
+
+class ISmmAPI {
+public:
+    virtual CreateInterfaceFn GetFileSystemFactory() = 0;
+    virtual CreateInterfaceFn GetEngineFactory(bool syn = true) = 0;
+    virtual const char *GetBaseDir() = 0;
+    virtual bool RegisterConCommandBase(void *plugin, ConCommandBase *commandBase) = 0;
+    virtual void ConPrintf(const char *format, ...) = 0;
+};
+
+class CSaveRestoreData;
+
+class IServerGameDLL {
+public:
+    virtual void GameFrame(bool simulating) = 0;
+};
+
+class IVEngineServer {
+public:
+    virtual bool IsDedicatedServer() = 0;
+    virtual const char *GetSaveFileName() = 0;
+    virtual const char *GetMostRecentlyLoadedFileName() = 0;
+};
+
+class CGlobalVars {
+public:
+    float curtime;
+    int tickcount;
+};
+
+class SDKExtension {
+public:
+    virtual bool SDK_OnLoad(char *error, size_t maxlength, bool late) { return true; }
+    virtual void SDK_OnUnload() {}
+    virtual void SDK_OnAllLoaded() {}
+    virtual bool SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlength, bool late) { return true; }
+    virtual bool SDK_OnMetamodUnload(char *error, size_t maxlength) { return true; }
+};
+
+extern IExtension *myself;
+extern IShareSys *sharesys;
+extern ISourceMod *smutils;
+extern IForwardManager *forwards;
+extern ISmmAPI *g_SMAPI;
+extern void *g_PLAPI;
+extern IServerGameDLL *gamedll;
+extern IVEngineServer *engine;
+extern CGlobalVars *gpGlobals;
+
+#define META_CONPRINTF g_SMAPI->ConPrintf
+#define META_REGCVAR(var) g_SMAPI->RegisterConCommandBase(g_PLAPI, var)
+
+#define GET_V_IFACE_CURRENT(v_factory, v_var, v_type, v_name) \
+    v_var = (v_type *) ismm->v_factory()(v_name, NULL); \
+    if (v_var == NULL) { \
+        return false; \
+    }
+
+// The hooks are never called by the engine in the benchmark, the benchmark calls the hooked functions itself
+enum META_RES {
+    MRES_IGNORED = 0,
+    MRES_HANDLED,
+    MRES_OVERRIDE,
+    MRES_SUPERCEDE
+};
+#define RETURN_META(result) return
+#define SH_NOATTRIB 0
+#define SH_DECL_HOOK1_void(ifacetype, ifacefunc, attr, overload, param1)
+#define SH_DECL_HOOK2_void(ifacetype, ifacefunc, attr, overload, param1, param2)
+#define SH_STATIC(handler) (handler)
+#define SH_MEMBER(instance, handler) (instance), (handler)
+#define SH_ADD_HOOK(ifacetype, ifacefunc, ifaceptr, handler, post) ((void) (ifaceptr))
+#define SH_REMOVE_HOOK(ifacetype, ifacefunc, ifaceptr, handler, post) ((void) (ifaceptr))
+
+#endif // _INCLUDE_AMM_BENCH_SMSDK_EXT_H_
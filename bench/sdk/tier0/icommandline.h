@@ -0,0 +1,16 @@
+/**
+ * Benchmark stand-in for the HL2SDK command line header, the benchmark runs with an empty command line
+ */
+
+#ifndef _INCLUDE_AMM_BENCH_ICOMMANDLINE_H_
+#define _INCLUDE_AMM_BENCH_ICOMMANDLINE_H_
+
+class ICommandLine {
+public:
+    virtual const char *ParmValue(const char *psz, const char *pDefaultVal = 0) const = 0;
+    virtual int ParmValue(const char *psz, int nDefaultVal) const = 0;
+};
+
+ICommandLine *CommandLine();
+
+#endif // _INCLUDE_AMM_BENCH_ICOMMANDLINE_H_
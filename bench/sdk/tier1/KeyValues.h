@@ -0,0 +1,3 @@
+/**
+ * Benchmark stand-in for the HL2SDK KeyValues header, the extension includes it without using it
+ */
@@ -0,0 +1,835 @@
+/**
+ * Stub FMOD backend for the benchmark, linked in place of the FMOD Core and Studio libraries
+ *
+ * It implements the part of the FMOD API the extension calls, against the real FMOD headers.
+ * Like FMOD, the API objects are opaque handles: each one points to a stub object below.
+ * Nothing is mixed, the stub only keeps the state the extension can observe:
+ * - Bank files are text, one "event <path> <length>", "bus <path>", "vca <path>" or "parameter <name> <min> <max> <default>" per line
+ * - Each update moves the playing events forward by AMM_STUB_UPDATE_MS and fires their beats at 120 BPM
+ * - Each call that FMOD would queue takes AMM_STUB_COMMAND_SIZE bytes of the command buffer until the next update
+ * - Non-blocking loads and sample data loads complete on the next update
+ */
+
+#include "fmod.hpp"
+#include "fmod_studio.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define AMM_STUB_UPDATE_MS 10
+#define AMM_STUB_BEAT_MS 500
+#define AMM_STUB_COMMAND_SIZE 32
+#define AMM_STUB_COMMAND_BUFFER_SIZE (32 * 1024)
+
+struct StubStudioSystem;
+struct StubEventDescription;
+
+struct StubEventInstance {
+    StubEventDescription *description;
+    bool valid;
+    bool released;
+    FMOD_STUDIO_PLAYBACK_STATE state;
+    int position;
+    FMOD_STUDIO_EVENT_CALLBACK callback;
+    FMOD_STUDIO_EVENT_CALLBACK_TYPE callbackMask;
+    void *userData;
+};
+
+struct StubEventDescription {
+    StubStudioSystem *system;
+    std::string path;
+    int length;
+    bool valid;
+    FMOD_STUDIO_LOADING_STATE sampleLoadingState;
+    std::vector<StubEventInstance *> instances;
+};
+
+struct StubMixer {
+    std::string path;
+    bool valid;
+    float volume;
+    bool paused;
+};
+
+struct StubParameter {
+    std::string name;
+    FMOD_STUDIO_PARAMETER_DESCRIPTION description;
+    float value;
+};
+
+struct StubBank {
+    bool valid;
+    FMOD_STUDIO_LOADING_STATE loadingState;
+    std::vector<StubEventDescription *> events;
+    std::vector<StubMixer *> buses;
+    std::vector<StubMixer *> vcas;
+    std::vector<std::string> parameterNames;
+};
+
+struct StubCoreSystem {
+    FMOD_OUTPUTTYPE output;
+    FMOD_FILE_OPEN_CALLBACK openCallback;
+    FMOD_FILE_CLOSE_CALLBACK closeCallback;
+    FMOD_FILE_ASYNCREAD_CALLBACK asyncReadCallback;
+    long long sampleBytesRead;
+    long long streamBytesRead;
+    long long otherBytesRead;
+};
+
+struct StubStudioSystem {
+    StubCoreSystem core;
+    // Objects live as long as the system, so stale handles stay safe to check
+    std::deque<StubBank> banks;
+    std::deque<StubEventDescription> eventDescriptions;
+    std::deque<StubEventInstance> eventInstances;
+    std::deque<StubMixer> mixers;
+    std::unordered_map<std::string, StubEventDescription *> events;
+    std::unordered_map<std::string, StubMixer *> buses;
+    std::unordered_map<std::string, StubMixer *> vcas;
+    std::vector<StubParameter> parameters;
+    std::vector<StubEventInstance *> releasedInstances;
+    FMOD_STUDIO_BUFFER_USAGE bufferUsage;
+    int bankMemory;
+};
+
+/**
+ * Helper function to take room in the command buffer, stalling like FMOD does when it's full
+ */
+static void QueueStubCommand(StubStudioSystem *system) {
+    FMOD_STUDIO_BUFFER_INFO &commandQueue = system->bufferUsage.studiocommandqueue;
+    if (commandQueue.currentusage + AMM_STUB_COMMAND_SIZE > commandQueue.capacity) {
+        // FMOD would make the caller wait for the next update to empty it
+        commandQueue.stallcount++;
+        commandQueue.currentusage = 0;
+    }
+    commandQueue.currentusage += AMM_STUB_COMMAND_SIZE;
+    if (commandQueue.currentusage > commandQueue.peakusage) {
+        commandQueue.peakusage = commandQueue.currentusage;
+    }
+}
+
+/**
+ * Helper function to copy a path the way the FMOD getPath functions do
+ */
+static FMOD_RESULT CopyStubPath(const std::string &value, char *path, int size, int *retrieved) {
+    if (retrieved != nullptr) {
+        *retrieved = (int) value.length() + 1;
+    }
+    if (path == nullptr || size <= 0) {
+        return FMOD_OK;
+    }
+    strncpy(path, value.c_str(), size - 1);
+    path[size - 1] = '\0';
+    return (int) value.length() < size ? FMOD_OK : FMOD_ERR_TRUNCATED;
+}
+
+/**
+ * Helper function to find the global parameter with an ID
+ */
+static StubParameter *FindStubParameter(StubStudioSystem *system, FMOD_STUDIO_PARAMETER_ID id) {
+    if (id.data1 == 0 || id.data1 > system->parameters.size()) {
+        return nullptr;
+    }
+    StubParameter &parameter = system->parameters[id.data1 - 1];
+    return parameter.description.id.data2 == id.data2 ? &parameter : nullptr;
+}
+
+/**
+ * Helper function to add a mixer to a bank, shared with the banks already holding it
+ */
+static StubMixer *AddStubMixer(StubStudioSystem *system, std::unordered_map<std::string, StubMixer *> &mixers, const std::string &path) {
+    auto it = mixers.find(path);
+    if (it != mixers.end()) {
+        return it->second;
+    }
+    system->mixers.push_back(StubMixer());
+    StubMixer *mixer = &system->mixers.back();
+    mixer->path = path;
+    mixer->valid = true;
+    mixer->volume = 1.0f;
+    mixer->paused = false;
+    mixers[path] = mixer;
+    return mixer;
+}
+
+/**
+ * Helper function to create a bank from the contents of a stub bank file
+ */
+static StubBank *CreateStubBank(StubStudioSystem *system, const char *buffer, int length, FMOD_STUDIO_LOAD_BANK_FLAGS flags) {
+    system->banks.push_back(StubBank());
+    StubBank *bank = &system->banks.back();
+    bank->valid = true;
+    bank->loadingState = (flags & FMOD_STUDIO_LOAD_BANK_NONBLOCKING) ? FMOD_STUDIO_LOADING_STATE_LOADING : FMOD_STUDIO_LOADING_STATE_LOADED;
+    system->bankMemory += length;
+    std::string contents(buffer, length);
+    size_t lineStart = 0;
+    while (lineStart < contents.length()) {
+        size_t lineEnd = contents.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = contents.length();
+        }
+        std::string line = contents.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        char kind[32], name[256];
+        float minimum, maximum, defaultValue;
+        int eventLength;
+        if (sscanf(line.c_str(), "event %255s %d", name, &eventLength) == 2) {
+            system->eventDescriptions.push_back(StubEventDescription());
+            StubEventDescription *event = &system->eventDescriptions.back();
+            event->system = system;
+            event->path = name;
+            event->length = eventLength;
+            event->valid = true;
+            event->sampleLoadingState = FMOD_STUDIO_LOADING_STATE_UNLOADED;
+            system->events[name] = event;
+            bank->events.push_back(event);
+        } else if (sscanf(line.c_str(), "parameter %255s %f %f %f", name, &minimum, &maximum, &defaultValue) == 4) {
+            StubParameter parameter;
+            parameter.name = name;
+            memset(&parameter.description, 0, sizeof(parameter.description));
+            parameter.description.id.data1 = (unsigned int) system->parameters.size() + 1;
+            parameter.description.id.data2 = 0x414D4D00u ^ parameter.description.id.data1;
+            parameter.description.minimum = minimum;
+            parameter.description.maximum = maximum;
+            parameter.description.defaultvalue = defaultValue;
+            parameter.description.flags = FMOD_STUDIO_PARAMETER_GLOBAL;
+            parameter.value = defaultValue;
+            system->parameters.push_back(parameter);
+            bank->parameterNames.push_back(name);
+        } else if (sscanf(line.c_str(), "%31s %255s", kind, name) == 2) {
+            if (strcmp(kind, "bus") == 0) {
+                bank->buses.push_back(AddStubMixer(system, system->buses, name));
+            } else if (strcmp(kind, "vca") == 0) {
+                bank->vcas.push_back(AddStubMixer(system, system->vcas, name));
+            }
+        }
+    }
+    // The descriptions point into the parameter list, which may have moved
+    for (StubParameter &parameter : system->parameters) {
+        parameter.description.name = parameter.name.c_str();
+    }
+    return bank;
+}
+
+/**
+ * Helper function to read a whole file through the file callbacks the extension set, like FMOD does for loadBankFile
+ */
+static bool ReadStubFile(StubCoreSystem *core, const char *filename, std::vector<char> &contents) {
+    if (core->openCallback == nullptr || core->asyncReadCallback == nullptr) {
+        FILE *file = fopen(filename, "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        char chunk[4096];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            contents.insert(contents.end(), chunk, chunk + read);
+        }
+        fclose(file);
+        return true;
+    }
+    unsigned int fileSize = 0;
+    void *handle = nullptr;
+    if (core->openCallback(filename, &fileSize, &handle, nullptr) != FMOD_OK) {
+        return false;
+    }
+    contents.resize(fileSize);
+    struct StubRead {
+        FMOD_ASYNCREADINFO info;
+        volatile bool done;
+        FMOD_RESULT result;
+    } read;
+    memset(&read, 0, sizeof(read));
+    read.info.handle = handle;
+    read.info.sizebytes = fileSize;
+    read.info.buffer = contents.data();
+    read.info.userdata = &read;
+    read.info.done = [](FMOD_ASYNCREADINFO *info, FMOD_RESULT result) {
+        StubRead *stubRead = (StubRead *) info->userdata;
+        stubRead->result = result;
+        __atomic_store_n(&stubRead->done, true, __ATOMIC_RELEASE);
+    };
+    bool queued = fileSize == 0 || core->asyncReadCallback(&read.info, nullptr) == FMOD_OK;
+    while (queued && fileSize > 0 && !__atomic_load_n(&read.done, __ATOMIC_ACQUIRE)) {
+    }
+    core->closeCallback(handle, nullptr);
+    core->otherBytesRead += read.info.bytesread;
+    return queued && (fileSize == 0 || read.result == FMOD_OK || read.result == FMOD_ERR_FILE_EOF);
+}
+
+// --------------
+// MEMORY
+// --------------
+
+FMOD_RESULT F_API FMOD_Memory_Initialize(void *poolmem, int poollen, FMOD_MEMORY_ALLOC_CALLBACK useralloc, FMOD_MEMORY_REALLOC_CALLBACK userrealloc,
+                                         FMOD_MEMORY_FREE_CALLBACK userfree, FMOD_MEMORY_TYPE memtypeflags) {
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD_Memory_GetStats(int *currentalloced, int *maxalloced, FMOD_BOOL blocking) {
+    *currentalloced = 0;
+    *maxalloced = 0;
+    return FMOD_OK;
+}
+
+// --------------
+// CORE SYSTEM
+// --------------
+
+FMOD_RESULT F_API FMOD::System::setOutput(FMOD_OUTPUTTYPE output) {
+    ((StubCoreSystem *) this)->output = output;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::System::getSoftwareFormat(int *samplerate, FMOD_SPEAKERMODE *speakermode, int *numrawspeakers) {
+    if (samplerate != nullptr) {
+        *samplerate = 48000;
+    }
+    if (speakermode != nullptr) {
+        *speakermode = FMOD_SPEAKERMODE_STEREO;
+    }
+    if (numrawspeakers != nullptr) {
+        *numrawspeakers = 2;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::System::getDSPBufferSize(unsigned int *bufferlength, int *numbuffers) {
+    if (bufferlength != nullptr) {
+        *bufferlength = 1024;
+    }
+    if (numbuffers != nullptr) {
+        *numbuffers = 4;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::System::setFileSystem(FMOD_FILE_OPEN_CALLBACK useropen, FMOD_FILE_CLOSE_CALLBACK userclose, FMOD_FILE_READ_CALLBACK userread,
+                                              FMOD_FILE_SEEK_CALLBACK userseek, FMOD_FILE_ASYNCREAD_CALLBACK userasyncread,
+                                              FMOD_FILE_ASYNCCANCEL_CALLBACK userasynccancel, int blockalign) {
+    StubCoreSystem *core = (StubCoreSystem *) this;
+    core->openCallback = useropen;
+    core->closeCallback = userclose;
+    core->asyncReadCallback = userasyncread;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::System::getFileUsage(long long *sampleBytesRead, long long *streamBytesRead, long long *otherBytesRead) {
+    StubCoreSystem *core = (StubCoreSystem *) this;
+    *sampleBytesRead = core->sampleBytesRead;
+    *streamBytesRead = core->streamBytesRead;
+    *otherBytesRead = core->otherBytesRead;
+    return FMOD_OK;
+}
+
+// --------------
+// STUDIO SYSTEM
+// --------------
+
+FMOD_RESULT F_API FMOD::Studio::System::create(System **system, unsigned int headerversion) {
+    StubStudioSystem *stubSystem = new StubStudioSystem();
+    memset(&stubSystem->core, 0, sizeof(stubSystem->core));
+    memset(&stubSystem->bufferUsage, 0, sizeof(stubSystem->bufferUsage));
+    stubSystem->bufferUsage.studiocommandqueue.capacity = AMM_STUB_COMMAND_BUFFER_SIZE;
+    stubSystem->bufferUsage.studiohandle.capacity = AMM_STUB_COMMAND_BUFFER_SIZE;
+    stubSystem->bankMemory = 0;
+    // The master bus is always there, even before the first bank
+    AddStubMixer(stubSystem, stubSystem->buses, "bus:/");
+    *system = (System *) stubSystem;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getCoreSystem(FMOD::System **coresystem) const {
+    *coresystem = (FMOD::System *) &((StubStudioSystem *) this)->core;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::initialize(int maxchannels, FMOD_STUDIO_INITFLAGS studioflags, FMOD_INITFLAGS flags, void *extradriverdata) {
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::release() {
+    delete (StubStudioSystem *) this;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::flushCommands() {
+    for (StubBank &bank : ((StubStudioSystem *) this)->banks) {
+        if (bank.valid && bank.loadingState == FMOD_STUDIO_LOADING_STATE_LOADING) {
+            bank.loadingState = FMOD_STUDIO_LOADING_STATE_LOADED;
+        }
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::update() {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    system->bufferUsage.studiocommandqueue.currentusage = 0;
+    for (StubEventInstance *instance : system->releasedInstances) {
+        instance->valid = false;
+    }
+    system->releasedInstances.clear();
+    for (StubBank &bank : system->banks) {
+        if (bank.valid && bank.loadingState == FMOD_STUDIO_LOADING_STATE_LOADING) {
+            bank.loadingState = FMOD_STUDIO_LOADING_STATE_LOADED;
+        }
+    }
+    for (StubEventDescription &event : system->eventDescriptions) {
+        if (event.sampleLoadingState == FMOD_STUDIO_LOADING_STATE_LOADING) {
+            event.sampleLoadingState = FMOD_STUDIO_LOADING_STATE_LOADED;
+            system->core.sampleBytesRead += event.length;
+        }
+        for (StubEventInstance *instance : event.instances) {
+            if (instance->state == FMOD_STUDIO_PLAYBACK_STOPPING) {
+                instance->state = FMOD_STUDIO_PLAYBACK_STOPPED;
+                continue;
+            }
+            if (instance->state != FMOD_STUDIO_PLAYBACK_PLAYING) {
+                continue;
+            }
+            int previousPosition = instance->position;
+            instance->position = (instance->position + AMM_STUB_UPDATE_MS) % (event.length > 0 ? event.length : 1);
+            bool beat = instance->position / AMM_STUB_BEAT_MS != previousPosition / AMM_STUB_BEAT_MS;
+            if (beat && instance->callback != nullptr && (instance->callbackMask & FMOD_STUDIO_EVENT_CALLBACK_TIMELINE_BEAT)) {
+                int beatIndex = instance->position / AMM_STUB_BEAT_MS;
+                FMOD_STUDIO_TIMELINE_BEAT_PROPERTIES properties;
+                properties.bar = beatIndex / 4 + 1;
+                properties.beat = beatIndex % 4 + 1;
+                properties.position = beatIndex * AMM_STUB_BEAT_MS;
+                properties.tempo = 60000.0f / AMM_STUB_BEAT_MS;
+                properties.timesignatureupper = 4;
+                properties.timesignaturelower = 4;
+                instance->callback(FMOD_STUDIO_EVENT_CALLBACK_TIMELINE_BEAT, (FMOD_STUDIO_EVENTINSTANCE *) instance, &properties);
+            }
+        }
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getEvent(const char *pathOrID, EventDescription **event) const {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    auto it = system->events.find(pathOrID);
+    if (it == system->events.end() || !it->second->valid) {
+        *event = nullptr;
+        return FMOD_ERR_EVENT_NOTFOUND;
+    }
+    *event = (EventDescription *) it->second;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getBus(const char *pathOrID, Bus **bus) const {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    auto it = system->buses.find(pathOrID);
+    if (it == system->buses.end() || !it->second->valid) {
+        *bus = nullptr;
+        return FMOD_ERR_EVENT_NOTFOUND;
+    }
+    *bus = (Bus *) it->second;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getVCA(const char *pathOrID, VCA **vca) const {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    auto it = system->vcas.find(pathOrID);
+    if (it == system->vcas.end() || !it->second->valid) {
+        *vca = nullptr;
+        return FMOD_ERR_EVENT_NOTFOUND;
+    }
+    *vca = (VCA *) it->second;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getParameterDescriptionByName(const char *name, FMOD_STUDIO_PARAMETER_DESCRIPTION *parameter) const {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    for (const StubParameter &stubParameter : system->parameters) {
+        if (stubParameter.name == name) {
+            *parameter = stubParameter.description;
+            return FMOD_OK;
+        }
+    }
+    return FMOD_ERR_EVENT_NOTFOUND;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getParameterDescriptionList(FMOD_STUDIO_PARAMETER_DESCRIPTION *array, int capacity, int *count) const {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    int copied = 0;
+    for (size_t i = 0; i < system->parameters.size() && copied < capacity; i++) {
+        array[copied++] = system->parameters[i].description;
+    }
+    if (count != nullptr) {
+        *count = copied;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getParameterByID(FMOD_STUDIO_PARAMETER_ID id, float *value, float *finalvalue) const {
+    StubParameter *parameter = FindStubParameter((StubStudioSystem *) this, id);
+    if (parameter == nullptr) {
+        return FMOD_ERR_INVALID_PARAM;
+    }
+    if (value != nullptr) {
+        *value = parameter->value;
+    }
+    if (finalvalue != nullptr) {
+        *finalvalue = parameter->value;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::setParameterByID(FMOD_STUDIO_PARAMETER_ID id, float value, bool ignoreseekspeed) {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    StubParameter *parameter = FindStubParameter(system, id);
+    if (parameter == nullptr) {
+        return FMOD_ERR_INVALID_PARAM;
+    }
+    QueueStubCommand(system);
+    parameter->value = value;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::setParametersByIDs(const FMOD_STUDIO_PARAMETER_ID *ids, float *values, int count, bool ignoreseekspeed) {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    for (int i = 0; i < count; i++) {
+        if (FindStubParameter(system, ids[i]) == nullptr) {
+            return FMOD_ERR_INVALID_PARAM;
+        }
+    }
+    // A single command, however many parameters it carries
+    QueueStubCommand(system);
+    for (int i = 0; i < count; i++) {
+        FindStubParameter(system, ids[i])->value = values[i];
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::setParameterByName(const char *name, float value, bool ignoreseekspeed) {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    for (StubParameter &parameter : system->parameters) {
+        if (parameter.name == name) {
+            QueueStubCommand(system);
+            parameter.value = value;
+            return FMOD_OK;
+        }
+    }
+    return FMOD_ERR_EVENT_NOTFOUND;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::loadBankFile(const char *filename, FMOD_STUDIO_LOAD_BANK_FLAGS flags, Bank **bank) {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    std::vector<char> contents;
+    if (!ReadStubFile(&system->core, filename, contents)) {
+        *bank = nullptr;
+        return FMOD_ERR_FILE_NOTFOUND;
+    }
+    *bank = (Bank *) CreateStubBank(system, contents.data(), (int) contents.size(), flags);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::loadBankMemory(const char *buffer, int length, FMOD_STUDIO_LOAD_MEMORY_MODE mode, FMOD_STUDIO_LOAD_BANK_FLAGS flags,
+                                                       Bank **bank) {
+    *bank = (Bank *) CreateStubBank((StubStudioSystem *) this, buffer, length, flags);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getBufferUsage(FMOD_STUDIO_BUFFER_USAGE *usage) const {
+    *usage = ((StubStudioSystem *) this)->bufferUsage;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::resetBufferUsage() {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    system->bufferUsage.studiocommandqueue.peakusage = system->bufferUsage.studiocommandqueue.currentusage;
+    system->bufferUsage.studiocommandqueue.stallcount = 0;
+    system->bufferUsage.studiocommandqueue.stalltime = 0.0f;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getCPUUsage(FMOD_STUDIO_CPU_USAGE *usage, FMOD_CPU_USAGE *usage_core) const {
+    if (usage != nullptr) {
+        memset(usage, 0, sizeof(*usage));
+    }
+    if (usage_core != nullptr) {
+        memset(usage_core, 0, sizeof(*usage_core));
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::System::getMemoryUsage(FMOD_STUDIO_MEMORY_USAGE *memoryusage) const {
+    StubStudioSystem *system = (StubStudioSystem *) this;
+    memoryusage->exclusive = (int) (system->eventInstances.size() * sizeof(StubEventInstance));
+    memoryusage->inclusive = memoryusage->exclusive + system->bankMemory;
+    memoryusage->sampledata = (int) system->core.sampleBytesRead;
+    return FMOD_OK;
+}
+
+// --------------
+// BANKS
+// --------------
+
+FMOD_RESULT F_API FMOD::Studio::Bank::unload() {
+    StubBank *bank = (StubBank *) this;
+    if (!bank->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    bank->valid = false;
+    for (StubEventDescription *event : bank->events) {
+        event->valid = false;
+        for (StubEventInstance *instance : event->instances) {
+            instance->valid = false;
+        }
+        event->instances.clear();
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getLoadingState(FMOD_STUDIO_LOADING_STATE *state) const {
+    StubBank *bank = (StubBank *) this;
+    if (!bank->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    *state = bank->loadingState;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getEventCount(int *count) const {
+    *count = (int) ((StubBank *) this)->events.size();
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getEventList(EventDescription **array, int capacity, int *count) const {
+    StubBank *bank = (StubBank *) this;
+    int copied = 0;
+    for (size_t i = 0; i < bank->events.size() && copied < capacity; i++) {
+        array[copied++] = (EventDescription *) bank->events[i];
+    }
+    if (count != nullptr) {
+        *count = copied;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getBusCount(int *count) const {
+    *count = (int) ((StubBank *) this)->buses.size();
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getBusList(Bus **array, int capacity, int *count) const {
+    StubBank *bank = (StubBank *) this;
+    int copied = 0;
+    for (size_t i = 0; i < bank->buses.size() && copied < capacity; i++) {
+        array[copied++] = (Bus *) bank->buses[i];
+    }
+    if (count != nullptr) {
+        *count = copied;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getVCACount(int *count) const {
+    *count = (int) ((StubBank *) this)->vcas.size();
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bank::getVCAList(VCA **array, int capacity, int *count) const {
+    StubBank *bank = (StubBank *) this;
+    int copied = 0;
+    for (size_t i = 0; i < bank->vcas.size() && copied < capacity; i++) {
+        array[copied++] = (VCA *) bank->vcas[i];
+    }
+    if (count != nullptr) {
+        *count = copied;
+    }
+    return FMOD_OK;
+}
+
+// --------------
+// EVENTS
+// --------------
+
+FMOD_RESULT F_API FMOD::Studio::EventDescription::getPath(char *path, int size, int *retrieved) const {
+    return CopyStubPath(((StubEventDescription *) this)->path, path, size, retrieved);
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventDescription::createInstance(EventInstance **instance) const {
+    StubEventDescription *event = (StubEventDescription *) this;
+    if (!event->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    StubStudioSystem *system = event->system;
+    system->eventInstances.push_back(StubEventInstance());
+    StubEventInstance *stubInstance = &system->eventInstances.back();
+    stubInstance->description = event;
+    stubInstance->valid = true;
+    stubInstance->released = false;
+    stubInstance->state = FMOD_STUDIO_PLAYBACK_STOPPED;
+    stubInstance->position = 0;
+    stubInstance->callback = nullptr;
+    stubInstance->callbackMask = 0;
+    stubInstance->userData = nullptr;
+    event->instances.push_back(stubInstance);
+    QueueStubCommand(system);
+    *instance = (EventInstance *) stubInstance;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventDescription::releaseAllInstances() {
+    StubEventDescription *event = (StubEventDescription *) this;
+    if (!event->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    for (StubEventInstance *instance : event->instances) {
+        instance->state = FMOD_STUDIO_PLAYBACK_STOPPED;
+        instance->released = true;
+        event->system->releasedInstances.push_back(instance);
+    }
+    event->instances.clear();
+    QueueStubCommand(event->system);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventDescription::loadSampleData() {
+    StubEventDescription *event = (StubEventDescription *) this;
+    if (event->sampleLoadingState != FMOD_STUDIO_LOADING_STATE_LOADED) {
+        event->sampleLoadingState = FMOD_STUDIO_LOADING_STATE_LOADING;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventDescription::unloadSampleData() {
+    ((StubEventDescription *) this)->sampleLoadingState = FMOD_STUDIO_LOADING_STATE_UNLOADED;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventDescription::getSampleLoadingState(FMOD_STUDIO_LOADING_STATE *state) const {
+    *state = ((StubEventDescription *) this)->sampleLoadingState;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::start() {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    instance->state = FMOD_STUDIO_PLAYBACK_PLAYING;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::stop(FMOD_STUDIO_STOP_MODE mode) {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    if (instance->state != FMOD_STUDIO_PLAYBACK_STOPPED) {
+        instance->state = mode == FMOD_STUDIO_STOP_IMMEDIATE ? FMOD_STUDIO_PLAYBACK_STOPPED : FMOD_STUDIO_PLAYBACK_STOPPING;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::getTimelinePosition(int *position) const {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    *position = instance->position;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::setTimelinePosition(int position) {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    instance->position = position;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::getPlaybackState(FMOD_STUDIO_PLAYBACK_STATE *state) const {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    *state = instance->state;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::setCallback(FMOD_STUDIO_EVENT_CALLBACK callback, FMOD_STUDIO_EVENT_CALLBACK_TYPE callbackmask) {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    instance->callback = callback;
+    instance->callbackMask = callbackmask;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::getUserData(void **userdata) const {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    *userdata = instance->userData;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::EventInstance::setUserData(void *userdata) {
+    StubEventInstance *instance = (StubEventInstance *) this;
+    if (!instance->valid) {
+        return FMOD_ERR_INVALID_HANDLE;
+    }
+    instance->userData = userdata;
+    return FMOD_OK;
+}
+
+// --------------
+// MIXERS
+// --------------
+
+FMOD_RESULT F_API FMOD::Studio::Bus::getPath(char *path, int size, int *retrieved) const {
+    return CopyStubPath(((StubMixer *) this)->path, path, size, retrieved);
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bus::getVolume(float *volume, float *finalvolume) const {
+    StubMixer *mixer = (StubMixer *) this;
+    if (volume != nullptr) {
+        *volume = mixer->volume;
+    }
+    if (finalvolume != nullptr) {
+        *finalvolume = mixer->paused ? 0.0f : mixer->volume;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bus::setVolume(float volume) {
+    ((StubMixer *) this)->volume = volume;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::Bus::setPaused(bool paused) {
+    ((StubMixer *) this)->paused = paused;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::VCA::getPath(char *path, int size, int *retrieved) const {
+    return CopyStubPath(((StubMixer *) this)->path, path, size, retrieved);
+}
+
+FMOD_RESULT F_API FMOD::Studio::VCA::getVolume(float *volume, float *finalvolume) const {
+    StubMixer *mixer = (StubMixer *) this;
+    if (volume != nullptr) {
+        *volume = mixer->volume;
+    }
+    if (finalvolume != nullptr) {
+        *finalvolume = mixer->volume;
+    }
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_API FMOD::Studio::VCA::setVolume(float volume) {
+    ((StubMixer *) this)->volume = volume;
+    return FMOD_OK;
+}
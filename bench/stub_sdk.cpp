@@ -0,0 +1,442 @@
+/**
+ * Fake SourceMod, Metamod and engine for the benchmark
+ * The file system goes straight to the disk, under a scratch directory standing for the game folder
+ * The engine is a listen server with a snd_musicvolume ConVar, so the extension takes the same paths as in a game
+ */
+
+#include "bench_sdk.h"
+#include "convar.h"
+#include "icvar.h"
+#include "filesystem.h"
+#include "tier0/icommandline.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+
+// --------------
+// CONVARS
+// --------------
+
+ConCommandBase *ConCommandBase::s_pConCommandBases = nullptr;
+
+ConCommandBase::ConCommandBase(const char *pName, const char *pHelpString, int flags)
+    : m_pszName(pName), m_pszHelpString(pHelpString != nullptr ? pHelpString : ""), m_nFlags(flags) {
+    m_pNext = s_pConCommandBases;
+    s_pConCommandBases = this;
+}
+
+ConCommandBase *ConCommandBase::Find(const char *pName) {
+    for (ConCommandBase *commandBase = s_pConCommandBases; commandBase != nullptr; commandBase = commandBase->m_pNext) {
+        if (strcmp(commandBase->GetName(), pName) == 0) {
+            return commandBase;
+        }
+    }
+    return nullptr;
+}
+
+ConCommand::ConCommand(const char *pName, FnCommandCallback_t callback, const char *pHelpString, int flags, void *completionFunc)
+    : ConCommandBase(pName, pHelpString, flags), m_fnCommandCallback(callback) {
+}
+
+ConVar::ConVar(const char *pName, const char *pDefaultValue, int flags, const char *pHelpString)
+    : ConVar(pName, pDefaultValue, flags, pHelpString, false, 0.0f, false, 0.0f) {
+}
+
+ConVar::ConVar(const char *pName, const char *pDefaultValue, int flags, const char *pHelpString, bool bMin, float fMin, bool bMax, float fMax,
+               FnChangeCallback_t callback)
+    : ConCommandBase(pName, pHelpString, flags), m_StringValue(pDefaultValue), m_fValue((float) atof(pDefaultValue)),
+      m_nValue((int) m_fValue), m_bHasMin(bMin), m_fMinVal(fMin), m_bHasMax(bMax), m_fMaxVal(fMax), m_fnChangeCallback(callback) {
+}
+
+void CallBenchGlobalChangeCallbacks(IConVar *var, const char *oldValue, float oldFloatValue);
+
+void ConVar::SetValue(const char *value) {
+    float floatValue = (float) atof(value);
+    std::string stringValue = value;
+    if ((m_bHasMin && floatValue < m_fMinVal) || (m_bHasMax && floatValue > m_fMaxVal)) {
+        floatValue = m_bHasMin && floatValue < m_fMinVal ? m_fMinVal : m_fMaxVal;
+        char clampedValue[32];
+        snprintf(clampedValue, sizeof(clampedValue), "%g", floatValue);
+        stringValue = clampedValue;
+    }
+    std::string oldValue = m_StringValue;
+    float oldFloatValue = m_fValue;
+    m_StringValue = stringValue;
+    m_fValue = floatValue;
+    m_nValue = (int) floatValue;
+    if (m_fnChangeCallback != nullptr) {
+        m_fnChangeCallback(this, oldValue.c_str(), oldFloatValue);
+    }
+    CallBenchGlobalChangeCallbacks(this, oldValue.c_str(), oldFloatValue);
+}
+
+void ConVar::SetValue(float value) {
+    char stringValue[32];
+    snprintf(stringValue, sizeof(stringValue), "%g", value);
+    SetValue(stringValue);
+}
+
+void ConVar::SetValue(int value) {
+    char stringValue[32];
+    snprintf(stringValue, sizeof(stringValue), "%d", value);
+    SetValue(stringValue);
+}
+
+void ConVar_Register(int nCVarFlag, IConCommandBaseAccessor *pAccessor) {
+    for (ConCommandBase *commandBase = ConCommandBase::s_pConCommandBases; commandBase != nullptr; commandBase = commandBase->m_pNext) {
+        if (pAccessor != nullptr) {
+            pAccessor->RegisterConCommandBase(commandBase);
+        }
+    }
+}
+
+void ConVar_Unregister() {
+    // The fake engine only knows the ConVars through the list, there's nothing to hand back
+}
+
+// The engine's own, the extension follows it
+ConVar snd_musicvolume("snd_musicvolume", "1.0", FCVAR_ARCHIVE, "Music volume", true, 0.0f, true, 1.0f);
+
+class BenchCvar : public ICvar {
+public:
+    ConVar *FindVar(const char *var_name) override {
+        ConCommandBase *commandBase = ConCommandBase::Find(var_name);
+        return commandBase != nullptr && !commandBase->IsCommand() ? static_cast<ConVar *>(commandBase) : nullptr;
+    }
+
+    void InstallGlobalChangeCallback(FnChangeCallback_t callback) override {
+        changeCallbacks.push_back(callback);
+    }
+
+    void RemoveGlobalChangeCallback(FnChangeCallback_t callback) override {
+        changeCallbacks.erase(std::remove(changeCallbacks.begin(), changeCallbacks.end(), callback), changeCallbacks.end());
+    }
+
+    std::vector<FnChangeCallback_t> changeCallbacks;
+};
+
+BenchCvar benchCvar;
+ICvar *g_pCVar = nullptr;
+
+void CallBenchGlobalChangeCallbacks(IConVar *var, const char *oldValue, float oldFloatValue) {
+    for (FnChangeCallback_t callback : benchCvar.changeCallbacks) {
+        callback(var, oldValue, oldFloatValue);
+    }
+}
+
+// --------------
+// COMMAND LINE
+// --------------
+
+class BenchCommandLine : public ICommandLine {
+public:
+    const char *ParmValue(const char *psz, const char *pDefaultVal) const override { return pDefaultVal; }
+
+    int ParmValue(const char *psz, int nDefaultVal) const override { return nDefaultVal; }
+};
+
+ICommandLine *CommandLine() {
+    static BenchCommandLine commandLine;
+    return &commandLine;
+}
+
+// --------------
+// FILE SYSTEM
+// --------------
+
+std::string benchBaseDir;
+
+/**
+ * Helper function to resolve a path of the game folder, whatever its path ID
+ */
+static std::string ResolveBenchPath(const char *path) {
+    if (path[0] == '/') {
+        return path;
+    }
+    return benchBaseDir + "/" + path;
+}
+
+class BenchFileSystem : public IFileSystem {
+public:
+    FileHandle_t Open(const char *pFileName, const char *pOptions, const char *pathID) override {
+        return fopen(ResolveBenchPath(pFileName).c_str(), pOptions);
+    }
+
+    void Close(FileHandle_t file) override {
+        fclose((FILE *) file);
+    }
+
+    int Read(void *pOutput, int size, FileHandle_t file) override {
+        return (int) fread(pOutput, 1, size, (FILE *) file);
+    }
+
+    int Write(void const *pInput, int size, FileHandle_t file) override {
+        return (int) fwrite(pInput, 1, size, (FILE *) file);
+    }
+
+    void Seek(FileHandle_t file, int pos, FileSystemSeek_t seekType) override {
+        fseek((FILE *) file, pos, seekType == FILESYSTEM_SEEK_HEAD ? SEEK_SET : seekType == FILESYSTEM_SEEK_CURRENT ? SEEK_CUR : SEEK_END);
+    }
+
+    unsigned int Size(FileHandle_t file) override {
+        struct stat fileStat;
+        return fstat(fileno((FILE *) file), &fileStat) == 0 ? (unsigned int) fileStat.st_size : 0;
+    }
+
+    unsigned int Size(const char *pFileName, const char *pPathID) override {
+        struct stat fileStat;
+        return stat(ResolveBenchPath(pFileName).c_str(), &fileStat) == 0 ? (unsigned int) fileStat.st_size : 0;
+    }
+
+    void Flush(FileHandle_t file) override {
+        fflush((FILE *) file);
+    }
+
+    bool FileExists(const char *pFileName, const char *pPathID) override {
+        struct stat fileStat;
+        return stat(ResolveBenchPath(pFileName).c_str(), &fileStat) == 0;
+    }
+
+    void RemoveFile(char const *pRelativePath, const char *pathID) override {
+        remove(ResolveBenchPath(pRelativePath).c_str());
+    }
+
+    long GetFileTime(const char *pFileName, const char *pPathID) override {
+        // Seconds, like the engine's
+        struct stat fileStat;
+        return stat(ResolveBenchPath(pFileName).c_str(), &fileStat) == 0 ? (long) fileStat.st_mtime : 0;
+    }
+
+    char *ReadLine(char *pOutput, int maxChars, FileHandle_t file) override {
+        return fgets(pOutput, maxChars, (FILE *) file);
+    }
+
+    void CreateDirHierarchy(const char *path, const char *pathID) override {
+        std::string fullPath = ResolveBenchPath(path);
+        for (size_t separator = fullPath.find('/', 1); ; separator = fullPath.find('/', separator + 1)) {
+            mkdir(fullPath.substr(0, separator).c_str(), 0755);
+            if (separator == std::string::npos) {
+                break;
+            }
+        }
+    }
+};
+
+BenchFileSystem benchFileSystem;
+
+// --------------
+// SOURCEMOD
+// --------------
+
+class BenchShareSys : public IShareSys {
+public:
+    void AddNatives(IExtension *myself, const sp_nativeinfo_t *natives) override {
+        for (const sp_nativeinfo_t *native = natives; native->name != nullptr; native++) {
+            this->natives.push_back(*native);
+        }
+    }
+
+    std::vector<sp_nativeinfo_t> natives;
+};
+
+class BenchSourceMod : public ISourceMod {
+public:
+    void LogMessage(IExtension *myself, const char *message, ...) override {
+    }
+};
+
+class BenchForward final : public IForward {
+public:
+    int Execute(cell_t *result, void *filter) override { return 0; }
+    int PushCell(cell_t cell) override { return 0; }
+    int PushFloat(float number) override { return 0; }
+    int PushString(const char *string) override { return 0; }
+};
+
+class BenchForwardManager : public IForwardManager {
+public:
+    IForward *CreateForward(const char *name, ExecType et, unsigned int num_params, const ParamType *types, ...) override {
+        return new BenchForward();
+    }
+
+    void ReleaseForward(IForward *forward) override {
+        delete static_cast<BenchForward *>(forward);
+    }
+};
+
+BenchShareSys benchShareSys;
+BenchSourceMod benchSourceMod;
+BenchForwardManager benchForwardManager;
+
+IExtension benchExtension;
+IExtension *myself = &benchExtension;
+IShareSys *sharesys = &benchShareSys;
+ISourceMod *smutils = &benchSourceMod;
+IForwardManager *forwards = &benchForwardManager;
+
+// --------------
+// METAMOD
+// --------------
+
+std::atomic<unsigned long long> benchConsoleMessages(0);
+bool benchVerbose = false;
+std::mutex benchConsoleMutex;
+
+static void *BenchInterfaceFactory(const char *name, int *returnCode) {
+    if (strcmp(name, FILESYSTEM_INTERFACE_VERSION) == 0) {
+        return static_cast<IFileSystem *>(&benchFileSystem);
+    }
+    if (strcmp(name, CVAR_INTERFACE_VERSION) == 0) {
+        return static_cast<ICvar *>(&benchCvar);
+    }
+    return nullptr;
+}
+
+class BenchSmmAPI : public ISmmAPI {
+public:
+    CreateInterfaceFn GetFileSystemFactory() override { return BenchInterfaceFactory; }
+
+    CreateInterfaceFn GetEngineFactory(bool syn) override { return BenchInterfaceFactory; }
+
+    const char *GetBaseDir() override { return benchBaseDir.c_str(); }
+
+    bool RegisterConCommandBase(void *plugin, ConCommandBase *commandBase) override { return true; }
+
+    void ConPrintf(const char *format, ...) override {
+        benchConsoleMessages.fetch_add(1, std::memory_order_relaxed);
+        if (!benchVerbose) {
+            return;
+        }
+        // The console is on stderr, stdout is kept for the results
+        std::lock_guard<std::mutex> lock(benchConsoleMutex);
+        va_list args;
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+    }
+};
+
+BenchSmmAPI benchSmmAPI;
+ISmmAPI *g_SMAPI = &benchSmmAPI;
+void *g_PLAPI = nullptr;
+
+// --------------
+// ENGINE
+// --------------
+
+class BenchGameDLL : public IServerGameDLL {
+public:
+    void GameFrame(bool simulating) override {
+    }
+};
+
+class BenchEngine : public IVEngineServer {
+public:
+    bool IsDedicatedServer() override { return false; }
+
+    const char *GetSaveFileName() override { return saveFileName.c_str(); }
+
+    const char *GetMostRecentlyLoadedFileName() override { return saveFileName.c_str(); }
+
+    std::string saveFileName;
+};
+
+BenchGameDLL benchGameDLL;
+BenchEngine benchEngine;
+CGlobalVars benchGlobals;
+IServerGameDLL *gamedll = &benchGameDLL;
+IVEngineServer *engine = &benchEngine;
+CGlobalVars *gpGlobals = &benchGlobals;
+
+// --------------
+// BENCHMARK SIDE
+// --------------
+
+void StartBenchSDK(const std::string &baseDir, bool verbose) {
+    benchBaseDir = baseDir;
+    benchVerbose = verbose;
+    benchFileSystem.CreateDirHierarchy(baseDir.c_str(), nullptr);
+    benchGlobals.curtime = 0.0f;
+    benchGlobals.tickcount = 0;
+}
+
+SPVM_NATIVE_FUNC FindBenchNative(const char *name) {
+    for (const sp_nativeinfo_t &native : benchShareSys.natives) {
+        if (strcmp(native.name, name) == 0) {
+            return native.func;
+        }
+    }
+    fprintf(stderr, "The extension did not register the %s native\n", name);
+    exit(1);
+}
+
+void SetBenchSaveFileName(const char *saveFileName) {
+    benchEngine.saveFileName = saveFileName;
+}
+
+unsigned long long GetBenchConsoleMessageCount() {
+    return benchConsoleMessages.load(std::memory_order_relaxed);
+}
+
+// The natives keep pointers into it, so it never grows
+#define BENCH_PLUGIN_MEMORY_SIZE (256 * 1024)
+
+BenchPluginContext::BenchPluginContext() : memory(BENCH_PLUGIN_MEMORY_SIZE), used(0) {
+    Reset();
+}
+
+int BenchPluginContext::LocalToString(cell_t local_addr, char **addr) {
+    *addr = memory.data() + local_addr;
+    return 0;
+}
+
+int BenchPluginContext::LocalToPhysAddr(cell_t local_addr, cell_t **phys_addr) {
+    *phys_addr = (cell_t *) (memory.data() + local_addr);
+    return 0;
+}
+
+int BenchPluginContext::StringToLocal(cell_t local_addr, size_t bytes, const char *source) {
+    if (bytes == 0) {
+        return 0;
+    }
+    strncpy(memory.data() + local_addr, source, bytes - 1);
+    memory[local_addr + bytes - 1] = '\0';
+    return 0;
+}
+
+cell_t BenchPluginContext::AllocString(const char *value) {
+    size_t length = strlen(value) + 1;
+    cell_t local = (cell_t) used;
+    if (used + length > memory.size()) {
+        fprintf(stderr, "The benchmark ran out of plugin memory\n");
+        exit(1);
+    }
+    memcpy(memory.data() + used, value, length);
+    used += (length + sizeof(cell_t) - 1) / sizeof(cell_t) * sizeof(cell_t);
+    return local;
+}
+
+cell_t BenchPluginContext::AllocCells(const cell_t *values, int count) {
+    size_t length = count * sizeof(cell_t);
+    cell_t local = (cell_t) used;
+    if (used + length > memory.size()) {
+        fprintf(stderr, "The benchmark ran out of plugin memory\n");
+        exit(1);
+    }
+    if (values != nullptr) {
+        memcpy(memory.data() + used, values, length);
+    } else {
+        memset(memory.data() + used, 0, length);
+    }
+    used += length;
+    return local;
+}
+
+void BenchPluginContext::Reset() {
+    // Address 0 stays unused, like a null string in a plugin
+    used = sizeof(cell_t);
+}
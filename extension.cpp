@@ -41,26 +41,86 @@
 
 // Personal includes
 #include "fmod_state.cpp"
+#include "fmod_banks.cpp"
+#include "fmod_prefetch.cpp"
+#include "fmod_filesystem.cpp"
+#include "fmod_mixer.cpp"
+#include "fmod_memory.cpp"
+#include "fmod_worker.cpp"
+#include "fmod_ramps.cpp"
+#include "fmod_timeline.cpp"
+#include "fmod_output.cpp"
+#include "fmod_stats.cpp"
+#include "fmod_telemetry.cpp"
 
 /**
  * @file extension.cpp
  * @brief Implement extension code here.
  */
 
+SH_DECL_HOOK1_void(IServerGameDLL, GameFrame, SH_NOATTRIB, 0, bool);
+
+ICvar *icvar = NULL;
+
 // ----------------
 // NATIVE FUNCTIONS
 // ----------------
 
 /**
- * SourceMod native function for AdaptiveMusicExt::LoadFMODBank
+ * SourceMod native function for AdaptiveMusicExt::LoadFMODBank, done by the audio thread before the operations queued after it
  */
 cell_t LoadFMODBank(IPluginContext *pContext, const cell_t *params)
 {
+    AMM_TIME_SCOPE("LoadFMODBank");
 	char *bankName;
 
     pContext->LocalToString(params[1], &bankName);
     std::string bankNameStr(bankName);
-    return g_AdaptiveMusicExt.LoadFMODBank(bankNameStr);
+    // The async argument is optional, plugins compiled against older includes only pass the bank name
+    bool async = params[0] >= 2 && params[2] != 0;
+    int bankHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        bankHandle = g_AdaptiveMusicExt.GetFMODBankHandle(bankNameStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_LoadBank, bankHandle, async ? 1.0f : 0.0f);
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::UnloadFMODBank, done by the audio thread
+ */
+cell_t UnloadFMODBank(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("UnloadFMODBank");
+    char *bankName;
+    pContext->LocalToString(params[1], &bankName);
+    std::string bankNameStr(bankName);
+    int bankHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        bankHandle = g_AdaptiveMusicExt.GetFMODBankHandle(bankNameStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_UnloadBank, bankHandle);
+    return 0;
+}
+
+/**
+ * SourceMod native function listing the resident banks, from the least to the most recently loaded, as last published by the audio thread
+ */
+cell_t GetLoadedFMODBanks(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetLoadedFMODBanks");
+    std::string bankNames;
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    for (const std::string &residentBankName : g_AdaptiveMusicExt.publishedResidentFMODBanks) {
+        if (!bankNames.empty()) {
+            bankNames += ",";
+        }
+        bankNames += residentBankName;
+    }
+    pContext->StringToLocal(params[1], params[2], bankNames.c_str());
+    return (cell_t) g_AdaptiveMusicExt.publishedResidentFMODBanks.size();
 }
 
 /**
@@ -68,10 +128,17 @@ cell_t LoadFMODBank(IPluginContext *pContext, const cell_t *params)
  */
 cell_t StartFMODEvent(IPluginContext *pContext, const cell_t *params)
 {
+    AMM_TIME_SCOPE("StartFMODEvent");
     char *eventPath;
     pContext->LocalToString(params[1], &eventPath);
     std::string eventPathStr(eventPath);
-    return g_AdaptiveMusicExt.StartFMODEvent(eventPathStr);
+    int eventHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        eventHandle = g_AdaptiveMusicExt.GetFMODEventHandle(eventPathStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_StartEvent, eventHandle);
+    return 0;
 }
 
 /**
@@ -79,10 +146,60 @@ cell_t StartFMODEvent(IPluginContext *pContext, const cell_t *params)
  */
 cell_t StopFMODEvent(IPluginContext *pContext, const cell_t *params)
 {
+    AMM_TIME_SCOPE("StopFMODEvent");
     char *eventPath;
     pContext->LocalToString(params[1], &eventPath);
     std::string eventPathStr(eventPath);
-    return g_AdaptiveMusicExt.StopFMODEvent(eventPathStr);
+    int eventHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        eventHandle = g_AdaptiveMusicExt.GetFMODEventHandle(eventPathStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_StopEvent, eventHandle);
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::GetFMODEventHandle
+ */
+cell_t GetFMODEventHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODEventHandle");
+    char *eventPath;
+    pContext->LocalToString(params[1], &eventPath);
+    std::string eventPathStr(eventPath);
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    return g_AdaptiveMusicExt.GetFMODEventHandle(eventPathStr);
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::StartFMODEventByHandle
+ */
+cell_t StartFMODEventByHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("StartFMODEventByHandle");
+    int eventHandle = params[1];
+    if (eventHandle < 0 || eventHandle >= g_AdaptiveMusicExt.fmodEventCount) {
+        META_CONPRINTF("AMM Extension - Invalid Event handle (%d)\n", eventHandle);
+        return -1;
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_StartEvent, eventHandle);
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::StopFMODEventByHandle
+ */
+cell_t StopFMODEventByHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("StopFMODEventByHandle");
+    int eventHandle = params[1];
+    if (eventHandle < 0 || eventHandle >= g_AdaptiveMusicExt.fmodEventCount) {
+        META_CONPRINTF("AMM Extension - Invalid Event handle (%d)\n", eventHandle);
+        return -1;
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_StopEvent, eventHandle);
+    return 0;
 }
 
 /**
@@ -90,11 +207,196 @@ cell_t StopFMODEvent(IPluginContext *pContext, const cell_t *params)
  */
 cell_t SetFMODGlobalParameter(IPluginContext *pContext, const cell_t *params)
 {
+    AMM_TIME_SCOPE("SetFMODGlobalParameter");
+    char *parameterName;
+    pContext->LocalToString(params[1], &parameterName);
+    std::string parameterNameStr(parameterName);
+    float value = sp_ctof(params[2]);
+    int parameterHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        parameterHandle = g_AdaptiveMusicExt.GetFMODParameterHandle(parameterNameStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetGlobalParameter, parameterHandle, value);
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::PrefetchFMODEvent, started by the audio thread
+ */
+cell_t PrefetchFMODEvent(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("PrefetchFMODEvent");
+    char *eventPath;
+    pContext->LocalToString(params[1], &eventPath);
+    std::string eventPathStr(eventPath);
+    int eventHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        eventHandle = g_AdaptiveMusicExt.GetFMODEventHandle(eventPathStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_PrefetchEvent, eventHandle);
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::ReleaseFMODEventPrefetch, done by the audio thread
+ */
+cell_t ReleaseFMODEventPrefetch(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("ReleaseFMODEventPrefetch");
+    char *eventPath;
+    pContext->LocalToString(params[1], &eventPath);
+    std::string eventPathStr(eventPath);
+    int eventHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        eventHandle = g_AdaptiveMusicExt.GetFMODEventHandle(eventPathStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_ReleaseEventPrefetch, eventHandle);
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the prefetch state of an event, as last polled by the audio thread
+ */
+cell_t GetFMODEventPrefetchState(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODEventPrefetchState");
+    char *eventPath;
+    pContext->LocalToString(params[1], &eventPath);
+    std::string eventPathStr(eventPath);
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    int eventHandle = g_AdaptiveMusicExt.GetFMODEventHandle(eventPathStr);
+    return g_AdaptiveMusicExt.fmodEventRegistry[eventHandle].prefetchState;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::GetFMODParameterHandle
+ */
+cell_t GetFMODParameterHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODParameterHandle");
     char *parameterName;
     pContext->LocalToString(params[1], &parameterName);
     std::string parameterNameStr(parameterName);
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    return g_AdaptiveMusicExt.GetFMODParameterHandle(parameterNameStr);
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::SetFMODGlobalParameterByHandle
+ */
+cell_t SetFMODGlobalParameterByHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("SetFMODGlobalParameterByHandle");
+    int parameterHandle = params[1];
     float value = sp_ctof(params[2]);
-    return g_AdaptiveMusicExt.SetFMODGlobalParameter(parameterNameStr, value);
+    if (parameterHandle < 0 || parameterHandle >= g_AdaptiveMusicExt.fmodParameterCount) {
+        META_CONPRINTF("AMM Extension - Invalid Global Parameter handle (%d)\n", parameterHandle);
+        return -1;
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetGlobalParameter, parameterHandle, value);
+    return 0;
+}
+
+/**
+ * SourceMod native function setting several global parameters by name, applied by the audio thread in a single FMOD call
+ */
+cell_t SetFMODGlobalParameters(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("SetFMODGlobalParameters");
+    cell_t *parameterNames;
+    cell_t *values;
+    int count = params[3];
+    pContext->LocalToPhysAddr(params[1], &parameterNames);
+    pContext->LocalToPhysAddr(params[2], &values);
+    std::vector<int> parameterHandles(count > 0 ? count : 0);
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        for (int i = 0; i < count; i++) {
+            // Each entry of the indirection vector is the offset from itself to its string
+            char *parameterName;
+            pContext->LocalToString(params[1] + i * sizeof(cell_t) + parameterNames[i], &parameterName);
+            std::string parameterNameStr(parameterName);
+            parameterHandles[i] = g_AdaptiveMusicExt.GetFMODParameterHandle(parameterNameStr);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetGlobalParameter, parameterHandles[i], sp_ctof(values[i]));
+    }
+    return 0;
+}
+
+/**
+ * SourceMod native function setting several global parameters by handle, applied by the audio thread in a single FMOD call
+ */
+cell_t SetFMODGlobalParametersByHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("SetFMODGlobalParametersByHandle");
+    cell_t *parameterHandles;
+    cell_t *values;
+    int count = params[3];
+    pContext->LocalToPhysAddr(params[1], &parameterHandles);
+    pContext->LocalToPhysAddr(params[2], &values);
+    // The whole set is checked first, so it's never applied partially
+    for (int i = 0; i < count; i++) {
+        if (parameterHandles[i] < 0 || parameterHandles[i] >= g_AdaptiveMusicExt.fmodParameterCount) {
+            META_CONPRINTF("AMM Extension - Invalid Global Parameter handle (%d)\n", parameterHandles[i]);
+            return -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetGlobalParameter, parameterHandles[i], sp_ctof(values[i]));
+    }
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::StartFMODParameterRamp, by parameter name
+ */
+cell_t RampFMODGlobalParameter(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("RampFMODGlobalParameter");
+    char *parameterName;
+    pContext->LocalToString(params[1], &parameterName);
+    std::string parameterNameStr(parameterName);
+    float targetValue = sp_ctof(params[2]);
+    float duration = params[3] / 1000.0f;
+    int curve = params[0] >= 4 ? params[4] : FMODRamp_Linear;
+    if (curve < 0 || curve >= FMODRamp_CurveCount) {
+        META_CONPRINTF("AMM Extension - Invalid ramp curve (%d)\n", curve);
+        return -1;
+    }
+    int parameterHandle;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+        parameterHandle = g_AdaptiveMusicExt.GetFMODParameterHandle(parameterNameStr);
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_RampGlobalParameter, parameterHandle, targetValue, duration, (FMODRampCurve) curve);
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::StartFMODParameterRamp
+ */
+cell_t RampFMODGlobalParameterByHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("RampFMODGlobalParameterByHandle");
+    int parameterHandle = params[1];
+    float targetValue = sp_ctof(params[2]);
+    float duration = params[3] / 1000.0f;
+    int curve = params[0] >= 4 ? params[4] : FMODRamp_Linear;
+    if (parameterHandle < 0 || parameterHandle >= g_AdaptiveMusicExt.fmodParameterCount) {
+        META_CONPRINTF("AMM Extension - Invalid Global Parameter handle (%d)\n", parameterHandle);
+        return -1;
+    }
+    if (curve < 0 || curve >= FMODRamp_CurveCount) {
+        META_CONPRINTF("AMM Extension - Invalid ramp curve (%d)\n", curve);
+        return -1;
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_RampGlobalParameter, parameterHandle, targetValue, duration, (FMODRampCurve) curve);
+    return 0;
 }
 
 /**
@@ -102,8 +404,255 @@ cell_t SetFMODGlobalParameter(IPluginContext *pContext, const cell_t *params)
  */
 cell_t SetFMODPausedState(IPluginContext *pContext, const cell_t *params)
 {
+    AMM_TIME_SCOPE("SetFMODPausedState");
     int pausedState = params[1];
-    return g_AdaptiveMusicExt.SetFMODPausedState(pausedState);
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetPausedState, 0, (float) pausedState);
+    // When leaving the paused state, it's a good measure to sync the settings, volume etc, to take into account the potential modifications made
+    // Read here rather than on the audio thread, it may need the client config file
+    if (!pausedState) {
+        SyncFMODSettings();
+    }
+    return 0;
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::GetFMODMixerHandle on a bus
+ */
+cell_t GetFMODBusHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODBusHandle");
+    char *busPath;
+    pContext->LocalToString(params[1], &busPath);
+    std::string busPathStr(busPath);
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    return g_AdaptiveMusicExt.GetFMODMixerHandle(busPathStr, FMODMixer_Bus);
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::GetFMODMixerHandle on a VCA
+ */
+cell_t GetFMODVCAHandle(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODVCAHandle");
+    char *vcaPath;
+    pContext->LocalToString(params[1], &vcaPath);
+    std::string vcaPathStr(vcaPath);
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    return g_AdaptiveMusicExt.GetFMODMixerHandle(vcaPathStr, FMODMixer_VCA);
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::SetFMODMixerVolume
+ */
+cell_t SetFMODMixerVolume(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("SetFMODMixerVolume");
+    int mixerHandle = params[1];
+    float volume = sp_ctof(params[2]);
+    float fadeTime = params[0] >= 3 ? sp_ctof(params[3]) : 0.0f;
+    if (mixerHandle < 0 || mixerHandle >= g_AdaptiveMusicExt.fmodMixerCount) {
+        META_CONPRINTF("AMM Extension - Invalid bus or VCA handle (%d)\n", mixerHandle);
+        return -1;
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetMixerVolume, mixerHandle, volume, fadeTime);
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the volume of a bus or VCA, as last applied by the audio thread
+ */
+cell_t GetFMODMixerVolume(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODMixerVolume");
+    int mixerHandle = params[1];
+    if (mixerHandle < 0 || mixerHandle >= g_AdaptiveMusicExt.fmodMixerCount) {
+        META_CONPRINTF("AMM Extension - Invalid bus or VCA handle (%d)\n", mixerHandle);
+        return sp_ftoc(-1.0f);
+    }
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    return sp_ftoc(g_AdaptiveMusicExt.fmodMixerRegistry[mixerHandle].volume);
+}
+
+/**
+ * SourceMod native function for AdaptiveMusicExt::SetFMODBusPaused
+ */
+cell_t SetFMODBusPaused(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("SetFMODBusPaused");
+    int mixerHandle = params[1];
+    int pausedState = params[2];
+    // VCA handles are rejected by the audio thread, the registry isn't looked at from here
+    if (mixerHandle < 0 || mixerHandle >= g_AdaptiveMusicExt.fmodMixerCount) {
+        META_CONPRINTF("AMM Extension - Invalid bus handle (%d)\n", mixerHandle);
+        return -1;
+    }
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetBusPaused, mixerHandle, (float) pausedState);
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the memory statistics of FMOD
+ */
+cell_t GetFMODMemoryStats(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODMemoryStats");
+    cell_t *currentBytes;
+    cell_t *peakBytes;
+    cell_t *allocations;
+    pContext->LocalToPhysAddr(params[1], &currentBytes);
+    pContext->LocalToPhysAddr(params[2], &peakBytes);
+    pContext->LocalToPhysAddr(params[3], &allocations);
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodMemoryMutex);
+    if (!g_AdaptiveMusicExt.fmodMemoryInitialized) {
+        return -1;
+    }
+    *currentBytes = (cell_t) g_AdaptiveMusicExt.fmodMemoryStats.currentBytes;
+    *peakBytes = (cell_t) g_AdaptiveMusicExt.fmodMemoryStats.peakBytes;
+    *allocations = (cell_t) g_AdaptiveMusicExt.fmodMemoryStats.allocations;
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the timeline position of the started event, as last published by the audio thread
+ */
+cell_t GetFMODTimelinePosition(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODTimelinePosition");
+    return g_AdaptiveMusicExt.GetFMODStateSnapshot().timelinePosition;
+}
+
+/**
+ * SourceMod native function reading the path of the started event, as last published by the audio thread
+ */
+cell_t GetFMODStartedEvent(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODStartedEvent");
+    FMODStateSnapshot snapshot = g_AdaptiveMusicExt.GetFMODStateSnapshot();
+    pContext->StringToLocal(params[1], params[2], snapshot.startedEventPath);
+    return snapshot.startedEventHandle;
+}
+
+/**
+ * SourceMod native function reading the playback state of the started event, as last published by the audio thread
+ */
+cell_t GetFMODPlaybackState(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODPlaybackState");
+    return g_AdaptiveMusicExt.GetFMODStateSnapshot().playbackState;
+}
+
+/**
+ * SourceMod native function reading the paused state of the master bus, as last published by the audio thread
+ */
+cell_t GetFMODPausedState(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODPausedState");
+    return g_AdaptiveMusicExt.GetFMODStateSnapshot().paused ? 1 : 0;
+}
+
+/**
+ * SourceMod native function reading the volume of the master bus, as last published by the audio thread
+ */
+cell_t GetFMODVolume(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODVolume");
+    return sp_ftoc(g_AdaptiveMusicExt.GetFMODStateSnapshot().volume);
+}
+
+/**
+ * SourceMod native function reading the CPU usage of FMOD, as last sampled by the audio thread
+ */
+cell_t GetFMODCPUUsage(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODCPUUsage");
+    FMODTelemetrySample sample = g_AdaptiveMusicExt.GetFMODStateSnapshot().telemetry;
+    if (sample.sample == 0) {
+        return -1;
+    }
+    cell_t *studioUpdate;
+    cell_t *coreUpdate;
+    cell_t *dsp;
+    cell_t *stream;
+    pContext->LocalToPhysAddr(params[1], &studioUpdate);
+    pContext->LocalToPhysAddr(params[2], &coreUpdate);
+    pContext->LocalToPhysAddr(params[3], &dsp);
+    pContext->LocalToPhysAddr(params[4], &stream);
+    *studioUpdate = sp_ftoc(sample.studioUpdateCPU);
+    *coreUpdate = sp_ftoc(sample.coreUpdateCPU);
+    *dsp = sp_ftoc(sample.dspCPU);
+    *stream = sp_ftoc(sample.streamCPU);
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the usage of an FMOD Studio buffer, as last sampled by the audio thread
+ */
+cell_t GetFMODBufferUsage(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODBufferUsage");
+    FMODTelemetrySample sample = g_AdaptiveMusicExt.GetFMODStateSnapshot().telemetry;
+    if (sample.sample == 0) {
+        return -1;
+    }
+    const FMOD_STUDIO_BUFFER_INFO &buffer = params[1] == 0 ? sample.commandQueue : sample.handles;
+    cell_t *peakUsage;
+    cell_t *capacity;
+    cell_t *stallCount;
+    cell_t *stallTime;
+    pContext->LocalToPhysAddr(params[2], &peakUsage);
+    pContext->LocalToPhysAddr(params[3], &capacity);
+    pContext->LocalToPhysAddr(params[4], &stallCount);
+    pContext->LocalToPhysAddr(params[5], &stallTime);
+    *peakUsage = buffer.peakusage;
+    *capacity = buffer.capacity;
+    *stallCount = buffer.stallcount;
+    *stallTime = sp_ftoc(buffer.stalltime);
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the memory usage of FMOD Studio, as last sampled by the audio thread
+ */
+cell_t GetFMODStudioMemoryUsage(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODStudioMemoryUsage");
+    FMODTelemetrySample sample = g_AdaptiveMusicExt.GetFMODStateSnapshot().telemetry;
+    if (sample.sample == 0) {
+        return -1;
+    }
+    cell_t *exclusive;
+    cell_t *inclusive;
+    cell_t *sampleData;
+    pContext->LocalToPhysAddr(params[1], &exclusive);
+    pContext->LocalToPhysAddr(params[2], &inclusive);
+    pContext->LocalToPhysAddr(params[3], &sampleData);
+    *exclusive = sample.memoryExclusive;
+    *inclusive = sample.memoryInclusive;
+    *sampleData = sample.sampleDataBytes;
+    return 0;
+}
+
+/**
+ * SourceMod native function reading the file usage of FMOD, as last sampled by the audio thread
+ */
+cell_t GetFMODFileUsage(IPluginContext *pContext, const cell_t *params)
+{
+    AMM_TIME_SCOPE("GetFMODFileUsage");
+    FMODTelemetrySample sample = g_AdaptiveMusicExt.GetFMODStateSnapshot().telemetry;
+    if (sample.sample == 0) {
+        return -1;
+    }
+    cell_t *sampleKilobytes;
+    cell_t *streamKilobytes;
+    cell_t *otherKilobytes;
+    pContext->LocalToPhysAddr(params[1], &sampleKilobytes);
+    pContext->LocalToPhysAddr(params[2], &streamKilobytes);
+    pContext->LocalToPhysAddr(params[3], &otherKilobytes);
+    // In kilobytes, so a long session doesn't overflow a cell
+    *sampleKilobytes = (cell_t) (sample.sampleBytesRead / 1024);
+    *streamKilobytes = (cell_t) (sample.streamBytesRead / 1024);
+    *otherKilobytes = (cell_t) (sample.otherBytesRead / 1024);
+    return 0;
 }
 
 /**
@@ -112,10 +661,39 @@ cell_t SetFMODPausedState(IPluginContext *pContext, const cell_t *params)
 const sp_nativeinfo_t MyNatives[] = 
 {
     {"LoadFMODBank", LoadFMODBank},
+    {"UnloadFMODBank", UnloadFMODBank},
+    {"GetLoadedFMODBanks", GetLoadedFMODBanks},
     {"StartFMODEvent", StartFMODEvent},
     {"StopFMODEvent", StopFMODEvent},
     {"SetFMODGlobalParameter", SetFMODGlobalParameter},
     {"SetFMODPausedState", SetFMODPausedState},
+    {"GetFMODEventHandle", GetFMODEventHandle},
+    {"StartFMODEventByHandle", StartFMODEventByHandle},
+    {"StopFMODEventByHandle", StopFMODEventByHandle},
+    {"PrefetchFMODEvent", PrefetchFMODEvent},
+    {"ReleaseFMODEventPrefetch", ReleaseFMODEventPrefetch},
+    {"GetFMODEventPrefetchState", GetFMODEventPrefetchState},
+    {"GetFMODParameterHandle", GetFMODParameterHandle},
+    {"SetFMODGlobalParameterByHandle", SetFMODGlobalParameterByHandle},
+    {"SetFMODGlobalParameters", SetFMODGlobalParameters},
+    {"SetFMODGlobalParametersByHandle", SetFMODGlobalParametersByHandle},
+    {"RampFMODGlobalParameter", RampFMODGlobalParameter},
+    {"RampFMODGlobalParameterByHandle", RampFMODGlobalParameterByHandle},
+    {"GetFMODBusHandle", GetFMODBusHandle},
+    {"GetFMODVCAHandle", GetFMODVCAHandle},
+    {"SetFMODMixerVolume", SetFMODMixerVolume},
+    {"GetFMODMixerVolume", GetFMODMixerVolume},
+    {"SetFMODBusPaused", SetFMODBusPaused},
+    {"GetFMODMemoryStats", GetFMODMemoryStats},
+    {"GetFMODTimelinePosition", GetFMODTimelinePosition},
+    {"GetFMODStartedEvent", GetFMODStartedEvent},
+    {"GetFMODPlaybackState", GetFMODPlaybackState},
+    {"GetFMODPausedState", GetFMODPausedState},
+    {"GetFMODVolume", GetFMODVolume},
+    {"GetFMODCPUUsage", GetFMODCPUUsage},
+    {"GetFMODBufferUsage", GetFMODBufferUsage},
+    {"GetFMODStudioMemoryUsage", GetFMODStudioMemoryUsage},
+    {"GetFMODFileUsage", GetFMODFileUsage},
     {NULL, NULL},
 };
 
@@ -125,8 +703,17 @@ const sp_nativeinfo_t MyNatives[] =
 
 bool AdaptiveMusicExt::SDK_OnLoad(char *error, size_t maxlen, bool late) {
     smutils->LogMessage(myself, "AMM Extension - SDK Loaded");
-    StartFMODEngine();
+    bankLoadedForward = forwards->CreateForward("OnFMODBankLoaded", ET_Ignore, 2, NULL, Param_String, Param_Cell);
+    eventPrefetchedForward = forwards->CreateForward("OnFMODEventPrefetched", ET_Ignore, 2, NULL, Param_String, Param_Cell);
+    timelineMarkerForward = forwards->CreateForward("OnFMODTimelineMarker", ET_Ignore, 3, NULL, Param_String, Param_String, Param_Cell);
+    beatForward = forwards->CreateForward("OnFMODBeat", ET_Ignore, 7, NULL, Param_String, Param_Cell, Param_Cell, Param_Cell, Param_Float, Param_Cell, Param_Cell);
     restoredTimelinePosition = 0;
+    startedFMODEventHandle = -1;
+    queuedFMODEventHandle = -1;
+    timelineEventHandle = -1;
+    if (StartFMODEngine() == 0) {
+        StartFMODWorker();
+    }
     return true;
 }
 
@@ -136,22 +723,63 @@ void AdaptiveMusicExt::SDK_OnAllLoaded() {
 
 void AdaptiveMusicExt::SDK_OnUnload() {
     smutils->LogMessage(myself, "AMM Extension - SDK Unloaded");
+    forwards->ReleaseForward(bankLoadedForward);
+    forwards->ReleaseForward(eventPrefetchedForward);
+    forwards->ReleaseForward(timelineMarkerForward);
+    forwards->ReleaseForward(beatForward);
+    // The audio and I/O threads must not outlive the extension
+    StopFMODWorker();
+    CloseFMODTelemetryLog();
+    if (fmodStudioSystem != nullptr) {
+        StopFMODEngine();
+    }
 }
 
 bool AdaptiveMusicExt::SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlen, bool late) {
     META_CONPRINTF("AMM Extension - MetaMod Loaded \n");
     CreateInterfaceFn fileSystemFactory = ismm->GetFileSystemFactory();
     GET_V_IFACE_CURRENT(GetEngineFactory, filesystem, IFileSystem, FILESYSTEM_INTERFACE_VERSION);  
+    GET_V_IFACE_CURRENT(GetEngineFactory, icvar, ICvar, CVAR_INTERFACE_VERSION);
+    g_pCVar = icvar;
+    ConVar_Register(0, this);
     AddFMODStateHooks();
+    SH_ADD_HOOK(IServerGameDLL, GameFrame, gamedll, SH_MEMBER(this, &AdaptiveMusicExt::Hook_GameFrame), true);
     return true;
 }
 
 bool AdaptiveMusicExt::SDK_OnMetamodUnload(char *error, size_t maxlen) {
     META_CONPRINTF("AMM Extension - MetaMod Unloaded \n");
     RemoveFMODStateHooks();
+    SH_REMOVE_HOOK(IServerGameDLL, GameFrame, gamedll, SH_MEMBER(this, &AdaptiveMusicExt::Hook_GameFrame), true);
+    // The engine would otherwise keep pointing at the ConVars and commands of the unloaded module
+    ConVar_Unregister();
     return true;
 }
 
+bool AdaptiveMusicExt::RegisterConCommandBase(ConCommandBase *pCommandBase) {
+    return META_REGCVAR(pCommandBase);
+}
+
+void AdaptiveMusicExt::Hook_GameFrame(bool simulating) {
+    if (fmodStudioSystem == nullptr) {
+        RETURN_META(MRES_IGNORED);
+    }
+    AMM_TIME_SCOPE("Game frame");
+    // FMOD itself is updated by the audio thread, the game frame only hands over what it couldn't take yet and fires the forwards
+    if (!overflowFMODCommands.empty()) {
+        FlushOverflowFMODCommands();
+    }
+    FireFMODNotifications();
+    FireFMODTimelineRecords();
+    PrintMusicStateWriteMessages();
+    if (amm_telemetry_log.GetBool()) {
+        WriteFMODTelemetryLog();
+    } else if (telemetryLogHandle != nullptr) {
+        CloseFMODTelemetryLog();
+    }
+    RETURN_META(MRES_IGNORED);
+}
+
 // --------------
 // FMOD FUNCTIONS
 // --------------
@@ -176,19 +804,39 @@ std::string SanitizeBankName(const std::string &bankName) {
  */
 int AdaptiveMusicExt::StartFMODEngine() {
     FMOD_RESULT result;
+    InitializeFMODMemory();
     result = FMOD::Studio::System::create(&fmodStudioSystem);
     if (result != FMOD_OK) {
         META_CONPRINTF("AMM Extension - FMOD engine could not be created (%d): %s\n", result,
                        FMOD_ErrorString(result));
         return (result);
     }
-    result = fmodStudioSystem->initialize(512, FMOD_STUDIO_INIT_NORMAL, FMOD_INIT_NORMAL, nullptr);
+    result = StartFMODFileSystem();
+    if (result != FMOD_OK) {
+        META_CONPRINTF("AMM Extension - FMOD file system could not be set up (%d): %s\n", result,
+                       FMOD_ErrorString(result));
+        return (result);
+    }
+    FMOD_STUDIO_INITFLAGS studioFlags = FMOD_STUDIO_INIT_NORMAL;
+    FMOD_INITFLAGS coreFlags = FMOD_INIT_NORMAL;
+    result = ConfigureFMODOutput(&studioFlags, &coreFlags);
+    if (result != FMOD_OK) {
+        META_CONPRINTF("AMM Extension - FMOD output could not be set up (%d): %s\n", result,
+                       FMOD_ErrorString(result));
+        return (result);
+    }
+    result = fmodStudioSystem->initialize(fmodMaxChannels, studioFlags, coreFlags, fmodOutputFile.empty() ? nullptr : (void *) fmodOutputFile.c_str());
     if (result != FMOD_OK) {
         META_CONPRINTF("AMM Extension - FMOD engine could not initialize (%d): %s\n", result,
                        FMOD_ErrorString(result));
         return (result);
     }
-    SyncFMODSettings(); // Sync the settings, volume etc
+    StartFMODMixClock();
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        masterBusHandle = GetFMODMixerHandle("", FMODMixer_Bus);
+    }
+    StartFMODSettingsSync(); // Sync the settings, volume etc, and keep following them
     META_CONPRINTF("AMM Extension - FMOD engine successfully started\n");
     return (0);
 }
@@ -205,6 +853,25 @@ int AdaptiveMusicExt::StopFMODEngine() {
                        FMOD_ErrorString(result));
         return (result);
     }
+    fmodStudioSystem = nullptr;
+    StopFMODSettingsSync();
+    StopFMODFileSystem();
+    // Releasing the system unloads every bank, so none of their buffers are in use anymore
+    for (FMODBankLoad &pendingLoad : pendingFMODBankLoads) {
+        FreeFMODBankMemory(&pendingLoad.bankMemory);
+        FreeFMODBankMemory(&pendingLoad.stringsBankMemory);
+    }
+    pendingFMODBankLoads.clear();
+    for (FMODBankResidency &residency : residentFMODBanks) {
+        FreeFMODBankMemory(&residency.bankMemory);
+        FreeFMODBankMemory(&residency.stringsBankMemory);
+    }
+    residentFMODBanks.clear();
+    for (FMODBankMemoryRelease &release : pendingFMODBankMemoryReleases) {
+        FreeFMODBankMemory(&release.memory);
+    }
+    pendingFMODBankMemoryReleases.clear();
+    ReleaseFMODMemory();
     META_CONPRINTF("AMM Extension - FMOD engine successfully stopped\n");
     return (0);
 }
@@ -224,87 +891,222 @@ std::string AdaptiveMusicExt::GetFMODBankPath(const std::string &bankName) {
     return bankPath;
 }
 
+/**
+ * Get the path of a Bank file in the sound/fmod/banks folder relative to the game search paths, so VPKs and custom mounts are searched too
+ * @param bankName The FMOD Bank name to locate
+ * @return The FMOD Bank's path for IFileSystem
+ */
+std::string AdaptiveMusicExt::GetFMODBankGamePath(const std::string &bankName) {
+    std::string sanitizedBankName = SanitizeBankName(bankName);
+    return "sound/fmod/banks/" + sanitizedBankName;
+}
+
 /**
  * Load an FMOD Bank
  * @param bankName The name of the FMOD Bank to load
+ * @param async true to load the bank in non-blocking mode, OnFMODBankLoaded is then fired from the game frame once the audio thread sees it ready
+ * Otherwise a non-blocking load of the same bank still in progress is waited for
  * @return The error code (or 0 if no error was encountered)
  */
-int AdaptiveMusicExt::LoadFMODBank(const std::string &bankName) {
-    if (loadedFMODStudioBankName == bankName) {
-        // Bank is already loaded
-        META_CONPRINTF("AMM Extension - FMOD bank requested for loading but already loaded: %s\n", bankName.c_str());
-    } else {
-        // Load the requested bank
-        std::string bankPath = GetFMODBankPath(bankName);
-        FMOD_RESULT result;
-        result = fmodStudioSystem->loadBankFile(bankPath.c_str(), FMOD_STUDIO_LOAD_BANK_NORMAL, &loadedFMODStudioBank);
-        if (result != FMOD_OK) {
-            META_CONPRINTF("AMM Extension - Could not load FMOD bank: %s. Error (%d): %s\n", bankName.c_str(), result, FMOD_ErrorString(result));
-            return (-1);
+int AdaptiveMusicExt::LoadFMODBank(const std::string &bankName, bool async) {
+    AMM_TIME_SCOPE("Bank load");
+    for (const FMODBankLoad &pendingLoad : pendingFMODBankLoads) {
+        if (pendingLoad.bankName != bankName) {
+            continue;
         }
-        std::string bankStringsName = bankName + ".strings";
-        std::string bankStringsPath = GetFMODBankPath(bankStringsName);
-        result = fmodStudioSystem->loadBankFile(bankStringsPath.c_str(), FMOD_STUDIO_LOAD_BANK_NORMAL, &loadedFMODStudioStringsBank);
-        if (result != FMOD_OK) {
-            META_CONPRINTF("AMM Extension - Could not load FMOD bank: %s. Error (%d): %\n", bankStringsName.c_str(), result, FMOD_ErrorString(result));
-            return (-1);
+        if (async) {
+            LogFMODMessage("AMM Extension - FMOD bank requested for loading but already loading: %s\n", bankName.c_str());
+            return (0);
         }
-        META_CONPRINTF("AMM Extension - Bank successfully loaded: %s\n", bankName.c_str());
+        // A blocking load waits for the one in progress, the operations queued after it must find the bank loaded
+        fmodStudioSystem->flushCommands();
+        PollPendingFMODBankLoads();
+        return FindResidentFMODBank(bankName) != -1 ? 0 : -1;
+    }
+    int bankIndex = FindResidentFMODBank(bankName);
+    if (bankIndex != -1) {
+        // Bank is already loaded
+        LogFMODMessage("AMM Extension - FMOD bank requested for loading but already loaded: %s\n", bankName.c_str());
         loadedFMODStudioBankName = bankName;
+        residentFMODBanksChanged = true;
+        TouchResidentFMODBank(bankIndex);
+        if (async) {
+            // The plugin still gets its OnFMODBankLoaded call
+            PushFMODNotification(FMODNotification_BankLoaded, bankName, 0);
+        }
+        return (0);
+    }
+    // Load the requested bank
+    FMOD_STUDIO_LOAD_BANK_FLAGS loadFlags = async ? FMOD_STUDIO_LOAD_BANK_NONBLOCKING : FMOD_STUDIO_LOAD_BANK_NORMAL;
+    FMODBankLoad bankLoad;
+    bankLoad.bankName = bankName;
+    FMOD_RESULT result;
+    result = LoadFMODBankFile(bankName, loadFlags, &bankLoad.bank, &bankLoad.bankMemory);
+    if (result != FMOD_OK) {
+        LogFMODMessage("AMM Extension - Could not load FMOD bank: %s. Error (%d): %s\n", bankName.c_str(), result, FMOD_ErrorString(result));
+        return (-1);
+    }
+    std::string bankStringsName = bankName + ".strings";
+    result = LoadFMODBankFile(bankStringsName, loadFlags, &bankLoad.stringsBank, &bankLoad.stringsBankMemory);
+    if (result != FMOD_OK) {
+        LogFMODMessage("AMM Extension - Could not load FMOD bank: %s. Error (%d): %s\n", bankStringsName.c_str(), result, FMOD_ErrorString(result));
+        UnloadFMODBankFile(bankLoad.bank, bankLoad.bankMemory);
+        return (-1);
     }
+    if (async) {
+        LogFMODMessage("AMM Extension - Bank loading in the background: %s\n", bankName.c_str());
+        pendingFMODBankLoads.push_back(bankLoad);
+        return (0);
+    }
+    LogFMODMessage("AMM Extension - Bank successfully loaded: %s\n", bankName.c_str());
+    OnFMODBankLoaded(bankLoad);
     return (0);
 }
 
+/**
+ * Register a freshly loaded bank and fill the caches with its contents
+ * @param loadedBank The loaded FMOD Bank and its .strings counterpart
+ */
+void AdaptiveMusicExt::OnFMODBankLoaded(const FMODBankLoad &loadedBank) {
+    loadedFMODStudioBankName = loadedBank.bankName;
+    residentFMODBanksChanged = true;
+    AddResidentFMODBank(loadedBank);
+    CacheFMODBankEvents(loadedBank.bank);
+    CacheFMODBankMixers(loadedBank.bank);
+    ResolveFMODParameters();
+    EnforceFMODBankMemoryBudget();
+}
+
+/**
+ * Check the banks loading in non-blocking mode, have OnFMODBankLoaded fired for the ones that are done
+ * and start the queued event once no bank is loading anymore
+ */
+void AdaptiveMusicExt::PollPendingFMODBankLoads() {
+    std::vector<FMODBankLoad> finishedLoads;
+    std::vector<int> finishedLoadErrors;
+    for (size_t i = 0; i < pendingFMODBankLoads.size();) {
+        FMODBankLoad &pendingLoad = pendingFMODBankLoads[i];
+        // When a bank fails to load, getLoadingState reports the ERROR state and returns the loading error
+        FMOD_STUDIO_LOADING_STATE bankState, stringsBankState;
+        FMOD_RESULT bankResult = pendingLoad.bank->getLoadingState(&bankState);
+        FMOD_RESULT stringsBankResult = pendingLoad.stringsBank->getLoadingState(&stringsBankState);
+        bool bankFailed = bankResult != FMOD_OK || bankState == FMOD_STUDIO_LOADING_STATE_ERROR;
+        bool stringsBankFailed = stringsBankResult != FMOD_OK || stringsBankState == FMOD_STUDIO_LOADING_STATE_ERROR;
+        if (!bankFailed && !stringsBankFailed && (bankState == FMOD_STUDIO_LOADING_STATE_LOADING || stringsBankState == FMOD_STUDIO_LOADING_STATE_LOADING)) {
+            i++;
+            continue;
+        }
+        int error = 0;
+        if (bankFailed) {
+            error = bankResult != FMOD_OK ? bankResult : FMOD_ERR_FILE_BAD;
+        } else if (stringsBankFailed) {
+            error = stringsBankResult != FMOD_OK ? stringsBankResult : FMOD_ERR_FILE_BAD;
+        }
+        finishedLoads.push_back(pendingLoad);
+        finishedLoadErrors.push_back(error);
+        pendingFMODBankLoads.erase(pendingFMODBankLoads.begin() + i);
+    }
+
+    for (size_t i = 0; i < finishedLoads.size(); i++) {
+        const FMODBankLoad &finishedLoad = finishedLoads[i];
+        int error = finishedLoadErrors[i];
+        if (error != 0) {
+            LogFMODMessage("AMM Extension - Could not load FMOD bank: %s. Error (%d): %s\n", finishedLoad.bankName.c_str(), error, FMOD_ErrorString((FMOD_RESULT) error));
+            UnloadFMODBankFile(finishedLoad.bank, finishedLoad.bankMemory);
+            UnloadFMODBankFile(finishedLoad.stringsBank, finishedLoad.stringsBankMemory);
+        } else {
+            LogFMODMessage("AMM Extension - Bank successfully loaded: %s\n", finishedLoad.bankName.c_str());
+            OnFMODBankLoaded(finishedLoad);
+        }
+        PushFMODNotification(FMODNotification_BankLoaded, finishedLoad.bankName, error);
+    }
+
+    if (pendingFMODBankLoads.empty() && queuedFMODEventHandle != -1) {
+        int eventHandle = queuedFMODEventHandle;
+        queuedFMODEventHandle = -1;
+        StartFMODEventByHandle(eventHandle);
+    }
+}
+
 /**
  * Start an FMOD Event
  * @param eventPath The name of the FMOD Event to start
  * @return The error code (or 0 if no error was encountered)
  */
 int AdaptiveMusicExt::StartFMODEvent(const std::string& eventPath) {
-    if (!startedFMODStudioEventPath.empty() && (eventPath == startedFMODStudioEventPath)) {
+    int eventHandle;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        eventHandle = GetFMODEventHandle(eventPath);
+    }
+    ResolveNewFMODRegistryEntries();
+    return StartFMODEventByHandle(eventHandle);
+}
+
+/**
+ * Start an FMOD Event from its handle, using its cached description
+ * @param eventHandle The handle of the FMOD Event to start, from GetFMODEventHandle
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::StartFMODEventByHandle(int eventHandle) {
+    AMM_TIME_SCOPE("Event start");
+    FMODEventEntry &event = fmodEvents[eventHandle];
+    if (!pendingFMODBankLoads.empty()) {
+        // The event may live in a bank that isn't ready yet, start it once loading is over
+        LogFMODMessage("AMM Extension - Event requested while banks are loading, queued until they're ready (%s)\n", event.path.c_str());
+        queuedFMODEventHandle = eventHandle;
+        return (0);
+    }
+    if (eventHandle == startedFMODEventHandle) {
         // Event is already loaded
-        META_CONPRINTF("AdaptiveMusic Plugin - Event requested for starting but already started (%s)\n", eventPath.c_str());
+        LogFMODMessage("AdaptiveMusic Plugin - Event requested for starting but already started (%s)\n", event.path.c_str());
         // However, if there's a restored timeline position from a save file, use it as we may be reloading from the same map (autosave, etc)
         if (restoredTimelinePosition != 0) {
             createdFMODStudioEventInstance->stop(FMOD_STUDIO_STOP_IMMEDIATE);
-            fmodStudioSystem->update();
             createdFMODStudioEventInstance->setTimelinePosition(restoredTimelinePosition);
             restoredTimelinePosition = 0;
             createdFMODStudioEventInstance->start();
-            fmodStudioSystem->update();
         }
     } else {
         // Event is new
-        if (!startedFMODStudioEventPath.empty()) {
+        if (startedFMODEventHandle != -1) {
             // Stop the currently playing event
-            StopFMODEvent(startedFMODStudioEventPath);
+            StopFMODEventByHandle(startedFMODEventHandle);
         }
 
-        const std::string eventPathPrefix = "event:/";
-        std::string fullEventPath = eventPathPrefix + eventPath;
+        if (event.description == nullptr && !ResolveFMODEvent(event)) {
+            LogFMODMessage("AdaptiveMusic Plugin - Could not start Event (%s), it doesn't exist in the loaded banks\n", event.path.c_str());
+            return (-1);
+        }
         FMOD_RESULT result;
-        result = fmodStudioSystem->getEvent(fullEventPath.c_str(), &startedFMODStudioEventDescription);
-        result = startedFMODStudioEventDescription->createInstance(&createdFMODStudioEventInstance);
+        result = event.description->createInstance(&createdFMODStudioEventInstance);
+        if (result != FMOD_OK) {
+            LogFMODMessage("AdaptiveMusic Plugin - Could not create an instance of Event (%s). Error: (%d) %s\n", event.path.c_str(), result,
+                           FMOD_ErrorString(result));
+            createdFMODStudioEventInstance = nullptr;
+            return (-1);
+        }
+        SetFMODTimelineCallbacks(createdFMODStudioEventInstance, eventHandle);
         
         // If there's a restored timeline position from a save file, use it
         if (restoredTimelinePosition != 0) {
             createdFMODStudioEventInstance->stop(FMOD_STUDIO_STOP_IMMEDIATE);
-            fmodStudioSystem->update();
             createdFMODStudioEventInstance->setTimelinePosition(restoredTimelinePosition);
             restoredTimelinePosition = 0;
         }
         
         result = createdFMODStudioEventInstance->start();
-        fmodStudioSystem->update();
         
         if (result != FMOD_OK) {
-            META_CONPRINTF("AdaptiveMusic Plugin - Could not start Event (%s). Error: (%d) %s\n", eventPath.c_str(), result,
+            LogFMODMessage("AdaptiveMusic Plugin - Could not start Event (%s). Error: (%d) %s\n", event.path.c_str(), result,
                            FMOD_ErrorString(result));
             return (-1);
         }
         
-        META_CONPRINTF("AdaptiveMusic Plugin - Event successfully started (%s)\n", eventPath.c_str());
-        startedFMODStudioEventPath = eventPath; // Assign directly, no need for new char array
+        LogFMODMessage("AdaptiveMusic Plugin - Event successfully started (%s)\n", event.path.c_str());
+        AddFMODBankReference(event.bank);
+        startedFMODEventHandle = eventHandle;
+        startedFMODStudioEventPath = event.path;
     }
     return (0);
 }
@@ -315,14 +1117,14 @@ int AdaptiveMusicExt::StartFMODEvent(const std::string& eventPath) {
  */
 int AdaptiveMusicExt::GetCurrentFMODTimelinePosition() {
     if (g_AdaptiveMusicExt.createdFMODStudioEventInstance == nullptr) {
-        META_CONPRINTF("AMM Extension - Asking for the current event instance timeline position but no event is running\n");
+        LogFMODMessage("AMM Extension - Asking for the current event instance timeline position but no event is running\n");
         return -1;
     }
     FMOD_RESULT result;
     int timelinePosition;
     result = g_AdaptiveMusicExt.createdFMODStudioEventInstance->getTimelinePosition(&timelinePosition);
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not find the timeline position from the event %s. Error: (%d) %s\n", g_AdaptiveMusicExt.startedFMODStudioEventPath, result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not find the timeline position from the event %s. Error: (%d) %s\n", g_AdaptiveMusicExt.startedFMODStudioEventPath.c_str(), result, FMOD_ErrorString(result));
         return -1;
     } else {
         return timelinePosition;
@@ -335,12 +1137,12 @@ int AdaptiveMusicExt::GetCurrentFMODTimelinePosition() {
 void AdaptiveMusicExt::SetCurrentFMODTimelinePosition(int timelinePosition) {
     /*
     if (g_AdaptiveMusicExt.createdFMODStudioEventInstance == nullptr) {
-        META_CONPRINTF("AMM Extension - Asking to update the current event instance timeline position but \n");
+        LogFMODMessage("AMM Extension - Asking to update the current event instance timeline position but \n");
     }
     FMOD_RESULT result;
     result = g_AdaptiveMusicExt.createdFMODStudioEventInstance->setTimelinePosition(timelinePosition);
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not find the timeline position from the event %s. Error: (%d) %s\n", g_AdaptiveMusicExt.startedFMODStudioEventPath, result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not find the timeline position from the event %s. Error: (%d) %s\n", g_AdaptiveMusicExt.startedFMODStudioEventPath.c_str(), result, FMOD_ErrorString(result));
     }
     */
     // ONLY SET THE VARIABLE
@@ -353,21 +1155,139 @@ void AdaptiveMusicExt::SetCurrentFMODTimelinePosition(int timelinePosition) {
  * @return The error code (or 0 if no error was encountered)
  */
 int AdaptiveMusicExt::StopFMODEvent(const std::string &eventPath) {
-    std::string eventPathPrefix = "event:/";
-    std::string fullEventPath = eventPathPrefix + eventPath; // Concatenate the prefix and event path
+    int eventHandle;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        eventHandle = GetFMODEventHandle(eventPath);
+    }
+    ResolveNewFMODRegistryEntries();
+    return StopFMODEventByHandle(eventHandle);
+}
+
+/**
+ * Stop an FMOD Event from its handle, using its cached description
+ * @param eventHandle The handle of the FMOD Event to stop, from GetFMODEventHandle
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::StopFMODEventByHandle(int eventHandle) {
+    AMM_TIME_SCOPE("Event stop");
+    FMODEventEntry &event = fmodEvents[eventHandle];
+    if (queuedFMODEventHandle == eventHandle) {
+        // The event was waiting for its bank, just forget about it
+        queuedFMODEventHandle = -1;
+        if (startedFMODEventHandle != eventHandle) {
+            LogFMODMessage("AMM Extension - Queued Event successfully cancelled (%s)\n", event.path.c_str());
+            return 0;
+        }
+    }
+    if (event.description == nullptr && !ResolveFMODEvent(event)) {
+        LogFMODMessage("AMM Extension - Could not stop Event (%s), it doesn't exist in the loaded banks\n", event.path.c_str());
+        return -1;
+    }
     FMOD_RESULT result;
-    result = fmodStudioSystem->getEvent(fullEventPath.c_str(), &startedFMODStudioEventDescription);
-    result = startedFMODStudioEventDescription->releaseAllInstances();
-    fmodStudioSystem->update();
+    result = event.description->releaseAllInstances();
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not stop Event (%s). Error: (%d) %s\n", eventPath.c_str(), result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not stop Event (%s). Error: (%d) %s\n", event.path.c_str(), result, FMOD_ErrorString(result));
         return -1;
     }
-    META_CONPRINTF("AMM Extension - Event successfully stopped (%s)\n", eventPath.c_str());
-    startedFMODStudioEventPath.clear();
+    LogFMODMessage("AMM Extension - Event successfully stopped (%s)\n", event.path.c_str());
+    if (startedFMODEventHandle == eventHandle) {
+        startedFMODEventHandle = -1;
+        startedFMODStudioEventPath.clear();
+        createdFMODStudioEventInstance = nullptr;
+        ReleaseFMODBankReference(event.bank);
+    }
     return 0;
 }
 
+/**
+ * Get the handle of an FMOD Event, registering it if it's the first time it's asked for
+ * Handles stay valid for the whole session, even if the Event isn't in the loaded banks yet
+ * Must be called with the registry mutex held
+ * @param eventPath The path of the FMOD Event, without the "event:/" prefix
+ * @return The handle of the FMOD Event
+ */
+int AdaptiveMusicExt::GetFMODEventHandle(const std::string &eventPath) {
+    auto it = fmodEventHandles.find(eventPath);
+    if (it != fmodEventHandles.end()) {
+        return it->second;
+    }
+    FMODEventRegistration registration;
+    registration.path = eventPath;
+    registration.prefetchState = FMODPrefetch_None;
+    int eventHandle = (int) fmodEventRegistry.size();
+    fmodEventRegistry.push_back(registration);
+    fmodEventHandles[eventPath] = eventHandle;
+    fmodEventCount = (int) fmodEventRegistry.size();
+    return eventHandle;
+}
+
+/**
+ * Look up the description of a registered Event that isn't cached, in case it comes from a bank loaded without its event list
+ * @param event The registered Event to resolve
+ * @return true if the Event exists in the loaded banks
+ */
+bool AdaptiveMusicExt::ResolveFMODEvent(FMODEventEntry &event) {
+    const std::string eventPathPrefix = "event:/";
+    std::string fullEventPath = eventPathPrefix + event.path;
+    FMOD_RESULT result;
+    result = fmodStudioSystem->getEvent(fullEventPath.c_str(), &event.description);
+    if (result != FMOD_OK) {
+        event.description = nullptr;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Cache the descriptions of all the Events of a loaded bank, keyed by their path
+ * @param bank The loaded FMOD Bank
+ */
+void AdaptiveMusicExt::CacheFMODBankEvents(FMOD::Studio::Bank *bank) {
+    int eventCount = 0;
+    FMOD_RESULT result;
+    result = bank->getEventCount(&eventCount);
+    if (result != FMOD_OK || eventCount == 0) {
+        return;
+    }
+    std::vector<FMOD::Studio::EventDescription *> eventDescriptions(eventCount);
+    result = bank->getEventList(eventDescriptions.data(), eventCount, &eventCount);
+    if (result != FMOD_OK) {
+        LogFMODMessage("AMM Extension - Could not list the Events of the bank. Error: (%d) %s\n", result, FMOD_ErrorString(result));
+        return;
+    }
+    const std::string eventPathPrefix = "event:/";
+    // The paths are listed first, so the registry mutex isn't held during the FMOD calls
+    std::vector<std::string> eventPaths;
+    std::vector<FMOD::Studio::EventDescription *> listedDescriptions;
+    for (int i = 0; i < eventCount; i++) {
+        char eventPath[512];
+        result = eventDescriptions[i]->getPath(eventPath, sizeof(eventPath), nullptr);
+        if (result != FMOD_OK) {
+            continue;
+        }
+        std::string eventPathStr(eventPath);
+        if (eventPathStr.compare(0, eventPathPrefix.size(), eventPathPrefix) == 0) {
+            eventPathStr = eventPathStr.substr(eventPathPrefix.size());
+        }
+        eventPaths.push_back(eventPathStr);
+        listedDescriptions.push_back(eventDescriptions[i]);
+    }
+    std::vector<int> eventHandles;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        for (const std::string &eventPath : eventPaths) {
+            eventHandles.push_back(GetFMODEventHandle(eventPath));
+        }
+        SyncFMODRegistryEntries();
+    }
+    for (size_t i = 0; i < eventHandles.size(); i++) {
+        FMODEventEntry &event = fmodEvents[eventHandles[i]];
+        event.description = listedDescriptions[i];
+        event.bank = bank;
+    }
+}
+
 /**
  * Set the value for a global FMOD Parameter
  * @param parameterName The name of the FMOD Parameter to set
@@ -375,18 +1295,166 @@ int AdaptiveMusicExt::StopFMODEvent(const std::string &eventPath) {
  * @return The error code (or 0 if no error was encountered)
  */
 int AdaptiveMusicExt::SetFMODGlobalParameter(const std::string &parameterName, float value) {
+    int parameterHandle;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        parameterHandle = GetFMODParameterHandle(parameterName);
+    }
+    ResolveNewFMODRegistryEntries();
+    int result = SetFMODGlobalParameterByHandle(parameterHandle, value);
+    if (result == 0) {
+        LogFMODMessage("AMM Extension - Global Parameter %s set to %f\n", parameterName.c_str(), value);
+    }
+    return result;
+}
+
+/**
+ * Set the value for a global FMOD Parameter from its handle, without any lookup by name
+ * @param parameterHandle The handle of the FMOD Parameter to set, from GetFMODParameterHandle
+ * @param value The value to set the FMOD Parameter to
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::SetFMODGlobalParameterByHandle(int parameterHandle, float value) {
+    AMM_TIME_SCOPE("Parameter set");
+    FMODParameterEntry &parameter = fmodParameters[parameterHandle];
+    if (!parameter.resolved) {
+        LogFMODMessage("AMM Extension - Could not set Global Parameter value (%s) (%f), it doesn't exist in the loaded banks\n",
+                       parameter.name.c_str(), value);
+        return -1;
+    }
     FMOD_RESULT result;
-    result = fmodStudioSystem->setParameterByName(parameterName.c_str(), value);
-    fmodStudioSystem->update();
+    result = fmodStudioSystem->setParameterByID(parameter.id, value);
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not set Global Parameter value (%s) (%f). Error: (%d) %s\n",
-                       parameterName.c_str(), value, result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not set Global Parameter value (%s) (%f). Error: (%d) %s\n",
+                       parameter.name.c_str(), value, result, FMOD_ErrorString(result));
+        parameter.valueApplied = false;
         return -1;
     }
-    META_CONPRINTF("AMM Extension - Global Parameter %s set to %f\n", parameterName.c_str(), value);
+    parameter.value = value;
+    parameter.valueApplied = true;
     return 0;
 }
 
+/**
+ * Set the values of several global FMOD Parameters from their handles, in a single FMOD call
+ * Parameters that already hold the value are skipped, the ones that don't exist in the loaded banks are reported once
+ * @param parameterHandles The handles of the FMOD Parameters to set, from GetFMODParameterHandle
+ * @param values The values to set the FMOD Parameters to
+ * @param count The number of FMOD Parameters to set
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::SetFMODGlobalParametersByHandle(const int *parameterHandles, const float *values, int count) {
+    AMM_TIME_SCOPE("Parameter batch set");
+    std::vector<FMOD_STUDIO_PARAMETER_ID> parameterIds;
+    std::vector<float> parameterValues;
+    parameterIds.reserve(count);
+    parameterValues.reserve(count);
+    for (int i = 0; i < count; i++) {
+        FMODParameterEntry &parameter = fmodParameters[parameterHandles[i]];
+        if (!parameter.resolved) {
+            // Resolved again by every bank load, looking it up on each set would only repeat the miss
+            if (!parameter.reported) {
+                LogFMODMessage("AMM Extension - Could not set Global Parameter value (%s) (%f), it doesn't exist in the loaded banks\n",
+                               parameter.name.c_str(), values[i]);
+                parameter.reported = true;
+            }
+            continue;
+        }
+        if (parameter.valueApplied && parameter.value == values[i]) {
+            continue;
+        }
+        parameterIds.push_back(parameter.id);
+        parameterValues.push_back(values[i]);
+        parameter.value = values[i];
+        parameter.valueApplied = true;
+    }
+    if (parameterIds.empty()) {
+        return 0;
+    }
+    FMOD_RESULT result;
+    result = fmodStudioSystem->setParametersByIDs(parameterIds.data(), parameterValues.data(), (int) parameterIds.size(), false);
+    if (result != FMOD_OK) {
+        LogFMODMessage("AMM Extension - Could not set %d Global Parameter values. Error: (%d) %s\n",
+                       (int) parameterIds.size(), result, FMOD_ErrorString(result));
+        // Nothing is known to be applied, so none of them gets skipped next time
+        for (int i = 0; i < count; i++) {
+            fmodParameters[parameterHandles[i]].valueApplied = false;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Get the handle of a global FMOD Parameter, registering it if it's the first time it's asked for
+ * Handles stay valid for the whole session, even if the Parameter doesn't exist in the loaded banks yet
+ * Registering doesn't call FMOD, the audio thread resolves the new Parameters before executing the next commands
+ * Must be called with the registry mutex held
+ * @param parameterName The name of the FMOD Parameter
+ * @return The handle of the FMOD Parameter
+ */
+int AdaptiveMusicExt::GetFMODParameterHandle(const std::string &parameterName) {
+    auto it = fmodParameterHandles.find(parameterName);
+    if (it != fmodParameterHandles.end()) {
+        return it->second;
+    }
+    FMODParameterRegistration registration;
+    registration.name = parameterName;
+    registration.resolved = false;
+    registration.value = 0.0f;
+    int parameterHandle = (int) fmodParameterRegistry.size();
+    fmodParameterRegistry.push_back(registration);
+    fmodParameterHandles[parameterName] = parameterHandle;
+    fmodParameterCount = (int) fmodParameterRegistry.size();
+    return parameterHandle;
+}
+
+/**
+ * Look up the FMOD ID of a single registered Parameter by its name, and the value FMOD holds for it
+ * @param parameter The registered Parameter to resolve
+ * @return true if the Parameter exists in the loaded banks
+ */
+bool AdaptiveMusicExt::ResolveFMODParameter(FMODParameterEntry &parameter) {
+    FMOD_STUDIO_PARAMETER_DESCRIPTION parameterDescription;
+    FMOD_RESULT result;
+    result = fmodStudioSystem->getParameterDescriptionByName(parameter.name.c_str(), &parameterDescription);
+    parameter.resolved = result == FMOD_OK;
+    if (parameter.resolved) {
+        parameter.id = parameterDescription.id;
+        // Published for the music state saves, which can't ask FMOD from the game thread
+        parameter.valueApplied = fmodStudioSystem->getParameterByID(parameter.id, &parameter.value) == FMOD_OK;
+    }
+    return parameter.resolved;
+}
+
+/**
+ * Resolve the FMOD IDs of all the global Parameters once a bank is loaded
+ * Parameters defined by the banks get registered, so their handles are ready before any plugin asks for them
+ */
+void AdaptiveMusicExt::ResolveFMODParameters() {
+    // Loading or unloading banks can reset the parameters to their default values in FMOD
+    for (FMODParameterEntry &parameter : fmodParameters) {
+        parameter.resolved = false;
+        parameter.valueApplied = false;
+    }
+    std::vector<FMOD_STUDIO_PARAMETER_DESCRIPTION> globalParameters = GetAllFMODGlobalParameters();
+    std::vector<int> parameterHandles;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        for (const FMOD_STUDIO_PARAMETER_DESCRIPTION &parameterDescription : globalParameters) {
+            parameterHandles.push_back(GetFMODParameterHandle(parameterDescription.name));
+        }
+        SyncFMODRegistryEntries();
+    }
+    for (size_t i = 0; i < parameterHandles.size(); i++) {
+        FMODParameterEntry &parameter = fmodParameters[parameterHandles[i]];
+        parameter.id = globalParameters[i].id;
+        parameter.resolved = true;
+        // Published for the music state saves, which can't ask FMOD from the game thread
+        parameter.valueApplied = fmodStudioSystem->getParameterByID(parameter.id, &parameter.value) == FMOD_OK;
+    }
+}
+
 /**
  * Get all the parameters registered in the bank
  * @return An array of all parameters registered in the bank
@@ -395,9 +1463,9 @@ std::vector<FMOD_STUDIO_PARAMETER_DESCRIPTION> AdaptiveMusicExt::GetAllFMODGloba
     FMOD_RESULT result;
     FMOD_STUDIO_PARAMETER_DESCRIPTION globalParameters[128];
     int parameterCount;
-    result = fmodStudioSystem->getParameterDescriptionList(globalParameters, sizeof(globalParameters), &parameterCount);
+    result = fmodStudioSystem->getParameterDescriptionList(globalParameters, sizeof(globalParameters) / sizeof(globalParameters[0]), &parameterCount);
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not get the Global Parameter count. Error: (%d) %s\n", result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not get the Global Parameter count. Error: (%d) %s\n", result, FMOD_ErrorString(result));
         return {}; // Return an empty vector in case of error
     } else {
         // Create a vector to hold the parameters
@@ -412,51 +1480,229 @@ std::vector<FMOD_STUDIO_PARAMETER_DESCRIPTION> AdaptiveMusicExt::GetAllFMODGloba
  * @return The error code (or 0 if no error was encountered)
  */
 int AdaptiveMusicExt::SetFMODPausedState(bool pausedState) {
-    META_CONPRINTF("AMM Extension - Setting the FMOD master bus paused state to %d\n", pausedState);
-    FMOD::Studio::Bus *bus = nullptr; // Initialize bus pointer to nullptr
-    FMOD_RESULT result;
-    result = fmodStudioSystem->getBus("bus:/", &bus);
-    if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not find the FMOD master bus! (%d) %s\n", result, FMOD_ErrorString(result));
+    LogFMODMessage("AMM Extension - Setting the FMOD master bus paused state to %d\n", pausedState);
+    FMOD::Studio::Bus *bus = GetFMODBus(masterBusHandle);
+    if (bus == nullptr) {
+        LogFMODMessage("AMM Extension - Could not find the FMOD master bus!\n");
         return -1;
     }
+    FMOD_RESULT result;
     result = bus->setPaused(pausedState);
-    fmodStudioSystem->update();
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not pause the FMOD master bus! (%d) %s\n", result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not pause the FMOD master bus! (%d) %s\n", result, FMOD_ErrorString(result));
         return -1;
     }
     knownFMODPausedState = pausedState;
-    // When leaving the paused state, it's a good measure to sync the settings, volume etc, to take into account the potential modifications made
-    if (!pausedState) {
-        SyncFMODSettings();
-    }
 
     return 0;
 }
 
 /**
  * Set the master bus volume
+ * Before any bank is loaded there's no master bus yet, the volume is then applied once a bank brings it
  * @param volume the desired volume from 0.0 to 1.0
  * @return The error code (or 0 if no error was encountered)
  */
 int AdaptiveMusicExt::SetFMODVolume(float volume) {
-    META_CONPRINTF("AMM Extension - Setting the FMOD volume to %f\n", volume);
-    FMOD::Studio::Bus *bus = nullptr; // Initialize bus pointer to nullptr
-    FMOD_RESULT result;
-    result = fmodStudioSystem->getBus("bus:/", &bus);
-    if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not find the FMOD master bus! (%d) %s\n", result, FMOD_ErrorString(result));
-        return -1;
+    LogFMODMessage("AMM Extension - Setting the FMOD volume to %f\n", volume);
+    FMOD::Studio::Bus *bus = GetFMODBus(masterBusHandle);
+    fmodMixers[masterBusHandle].volume = volume;
+    if (bus == nullptr) {
+        return 0;
     }
+    FMOD_RESULT result;
     result = bus->setVolume(volume);
-    fmodStudioSystem->update();
     if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not set the FMOD master bus volume! (%d) %s\n", result, FMOD_ErrorString(result));
+        LogFMODMessage("AMM Extension - Could not set the FMOD master bus volume! (%d) %s\n", result, FMOD_ErrorString(result));
         return -1;
     }
 
     return 0;
 }
 
+// -------------
+// COMMAND QUEUE
+// -------------
+
+/**
+ * Queue an FMOD operation on an event for the audio thread, to be executed right before its next FMOD update
+ * Only ever called from the game thread, the single producer of the command ring
+ * @param type The kind of operation to queue
+ * @param eventHandle The handle of the event the operation applies to
+ */
+void AdaptiveMusicExt::QueueFMODCommand(FMODCommandType type, int eventHandle) {
+    QueueFMODCommand(type, eventHandle, 0.0f);
+}
+
+/**
+ * Queue an FMOD operation taking a value for the audio thread, to be executed right before its next FMOD update
+ * Only ever called from the game thread, the single producer of the command ring
+ * @param type The kind of operation to queue
+ * @param parameterHandle The handle of the parameter, bus or VCA the operation applies to, if any
+ * @param value The parameter value, volume or paused state to set
+ * @param fadeTime The time to reach the volume or value, in seconds, for the mixer volumes and parameter ramps
+ * @param curve The shape of the parameter ramps
+ */
+void AdaptiveMusicExt::QueueFMODCommand(FMODCommandType type, int parameterHandle, float value, float fadeTime, FMODRampCurve curve) {
+    FMODCommand command;
+    command.type = type;
+    command.handle = parameterHandle;
+    command.value = value;
+    command.fadeTime = fadeTime;
+    command.curve = curve;
+    // Once an operation overflowed, the next ones wait behind it so the order is kept
+    if (!overflowFMODCommands.empty() || !fmodCommandRing.Push(command)) {
+        overflowFMODCommands.push_back(command);
+    }
+}
+
+/**
+ * Hand the operations that overflowed the command ring over to the audio thread, from the game frame
+ */
+void AdaptiveMusicExt::FlushOverflowFMODCommands() {
+    size_t pushedCommands = 0;
+    while (pushedCommands < overflowFMODCommands.size() && fmodCommandRing.Push(overflowFMODCommands[pushedCommands])) {
+        pushedCommands++;
+    }
+    overflowFMODCommands.erase(overflowFMODCommands.begin(), overflowFMODCommands.begin() + pushedCommands);
+}
+
+/**
+ * Execute the FMOD operations queued by the natives since the last update of the audio thread, in order
+ * Only the last requested value of a parameter, volume or paused state is kept for the update
+ * Bank loads and unloads split the update, the operations are never merged across them
+ */
+void AdaptiveMusicExt::ExecuteQueuedFMODCommands() {
+    FMODCommand command;
+    size_t segmentStart = 0;
+    while (fmodCommandRing.Pop(command)) {
+        bool coalesced = false;
+        if (command.type == FMODCommand_LoadBank || command.type == FMODCommand_UnloadBank) {
+            executingFMODCommands.push_back(command);
+            segmentStart = executingFMODCommands.size();
+            continue;
+        }
+        if (command.type == FMODCommand_SetGlobalParameter) {
+            // Setting a parameter overrides both its earlier value and its earlier ramp of the update
+            // A set that comes before a ramp is kept, so the sets applied first still leave the ramp starting from it
+            size_t keptCommands = segmentStart;
+            for (size_t i = segmentStart; i < executingFMODCommands.size(); i++) {
+                const FMODCommand &executingCommand = executingFMODCommands[i];
+                if ((executingCommand.type == FMODCommand_SetGlobalParameter || executingCommand.type == FMODCommand_RampGlobalParameter) &&
+                    executingCommand.handle == command.handle) {
+                    continue;
+                }
+                executingFMODCommands[keptCommands++] = executingCommand;
+            }
+            executingFMODCommands.resize(keptCommands);
+            executingFMODCommands.push_back(command);
+            continue;
+        }
+        // Starting and stopping, or prefetching and releasing, only make sense in the order they were asked for
+        if (command.type != FMODCommand_StartEvent && command.type != FMODCommand_StopEvent &&
+            command.type != FMODCommand_PrefetchEvent && command.type != FMODCommand_ReleaseEventPrefetch) {
+            for (size_t i = segmentStart; i < executingFMODCommands.size(); i++) {
+                FMODCommand &executingCommand = executingFMODCommands[i];
+                if (executingCommand.type == command.type && executingCommand.handle == command.handle) {
+                    executingCommand = command;
+                    coalesced = true;
+                    break;
+                }
+            }
+        }
+        if (!coalesced) {
+            executingFMODCommands.push_back(command);
+        }
+    }
+    // The vectors keep their capacity from update to update
+    size_t commandsStart = 0;
+    for (size_t i = 0; i < executingFMODCommands.size(); i++) {
+        const FMODCommand &executingCommand = executingFMODCommands[i];
+        if (executingCommand.type != FMODCommand_LoadBank && executingCommand.type != FMODCommand_UnloadBank) {
+            continue;
+        }
+        ExecuteFMODCommands(commandsStart, i);
+        commandsStart = i + 1;
+        std::string bankName;
+        {
+            std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+            bankName = fmodBankRegistry[executingCommand.handle];
+        }
+        if (executingCommand.type == FMODCommand_LoadBank) {
+            LoadFMODBank(bankName, executingCommand.value != 0.0f);
+        } else {
+            UnloadFMODBank(bankName);
+        }
+    }
+    ExecuteFMODCommands(commandsStart, executingFMODCommands.size());
+    executingFMODCommands.clear();
+}
+
+/**
+ * Execute a run of the queued FMOD operations that has no bank load or unload in it
+ * @param begin The index of the first operation in executingFMODCommands
+ * @param end The index past the last operation
+ */
+void AdaptiveMusicExt::ExecuteFMODCommands(size_t begin, size_t end) {
+    // All the global parameters of the run go to FMOD at once, before the events are started
+    batchedFMODParameterHandles.clear();
+    batchedFMODParameterValues.clear();
+    for (size_t i = begin; i < end; i++) {
+        const FMODCommand &executingCommand = executingFMODCommands[i];
+        if (executingCommand.type == FMODCommand_SetGlobalParameter) {
+            // Setting a parameter stops its ramp
+            if (!activeFMODParameterRamps.empty()) {
+                CancelFMODParameterRamp(executingCommand.handle);
+            }
+            batchedFMODParameterHandles.push_back(executingCommand.handle);
+            batchedFMODParameterValues.push_back(executingCommand.value);
+        }
+    }
+    if (!batchedFMODParameterHandles.empty()) {
+        SetFMODGlobalParametersByHandle(batchedFMODParameterHandles.data(), batchedFMODParameterValues.data(), (int) batchedFMODParameterHandles.size());
+    }
+    for (size_t i = begin; i < end; i++) {
+        const FMODCommand &executingCommand = executingFMODCommands[i];
+        switch (executingCommand.type) {
+            case FMODCommand_StartEvent:
+                StartFMODEventByHandle(executingCommand.handle);
+                break;
+            case FMODCommand_StopEvent:
+                StopFMODEventByHandle(executingCommand.handle);
+                break;
+            case FMODCommand_SetGlobalParameter:
+                // Already applied with the batch
+                break;
+            case FMODCommand_SetPausedState:
+                SetFMODPausedState(executingCommand.value != 0.0f);
+                break;
+            case FMODCommand_SetBusPaused:
+                SetFMODBusPaused(executingCommand.handle, executingCommand.value != 0.0f);
+                break;
+            case FMODCommand_SetMixerVolume:
+                SetFMODMixerVolume(executingCommand.handle, executingCommand.value, executingCommand.fadeTime);
+                break;
+            case FMODCommand_SetVolume:
+                SetFMODVolume(executingCommand.value);
+                break;
+            case FMODCommand_RampGlobalParameter:
+                StartFMODParameterRamp(executingCommand.handle, executingCommand.value, executingCommand.fadeTime, (FMODRampCurve) executingCommand.curve);
+                break;
+            case FMODCommand_PrefetchEvent:
+                PrefetchFMODEvent(executingCommand.handle);
+                break;
+            case FMODCommand_ReleaseEventPrefetch:
+                ReleaseFMODEventPrefetch(executingCommand.handle);
+                break;
+            case FMODCommand_SetTimelinePosition:
+                SetCurrentFMODTimelinePosition(executingCommand.handle);
+                break;
+            case FMODCommand_LoadBank:
+            case FMODCommand_UnloadBank:
+                // Executed between the runs
+                break;
+        }
+    }
+}
+
 SMEXT_LINK(&g_AdaptiveMusicExt);
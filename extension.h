@@ -39,17 +39,481 @@
 
 #include "smsdk_ext.h"
 #include <filesystem.h>
+#include <convar.h>
+#include <icvar.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
 
 // FMOD Includes
 #include "fmod.hpp"
 #include "fmod_studio.hpp"
 #include "fmod_errors.h"
 
+/**
+ * @brief A bank file read into memory owned by the extension, FMOD uses it in place for the bank's whole lifetime
+ */
+struct FMODBankMemory {
+    char *allocation; // nullptr when FMOD reads the bank file itself
+    char *data; // Start of the bank data, aligned to FMOD_STUDIO_LOAD_MEMORY_ALIGNMENT
+    int length;
+};
+
+/**
+ * @brief A bank and its .strings counterpart as loaded by LoadFMODBank, in non-blocking mode it's polled from the audio thread until both are ready
+ */
+struct FMODBankLoad {
+    std::string bankName;
+    FMOD::Studio::Bank *bank;
+    FMODBankMemory bankMemory;
+    FMOD::Studio::Bank *stringsBank;
+    FMODBankMemory stringsBankMemory;
+};
+
+/**
+ * @brief The memory of an unloaded bank, kept until FMOD is done unloading it
+ */
+struct FMODBankMemoryRelease {
+    FMOD::Studio::Bank *bank;
+    FMODBankMemory memory;
+};
+
+/**
+ * @brief The kinds of FMOD operations the natives queue for the audio thread
+ */
+enum FMODCommandType {
+    FMODCommand_StartEvent,
+    FMODCommand_StopEvent,
+    FMODCommand_SetGlobalParameter,
+    FMODCommand_SetPausedState,
+    FMODCommand_SetBusPaused,
+    FMODCommand_SetMixerVolume,
+    FMODCommand_SetVolume,
+    FMODCommand_RampGlobalParameter,
+    FMODCommand_PrefetchEvent,
+    FMODCommand_ReleaseEventPrefetch,
+    FMODCommand_LoadBank,
+    FMODCommand_UnloadBank,
+    FMODCommand_SetTimelinePosition,
+};
+
+/**
+ * @brief An FMOD operation queued by a native, executed by the audio thread before its next FMOD update
+ */
+struct FMODCommand {
+    FMODCommandType type;
+    int handle; // Event, parameter, bus, VCA or bank the operation applies to, or the restored timeline position
+    float value; // Parameter value, volume, paused state, or whether a bank loads in non-blocking mode
+    float fadeTime; // In seconds, for the mixer volumes and parameter ramps
+    int curve; // FMODRampCurve of the parameter ramps
+};
+
+/**
+ * @brief Lock-free queue between exactly one producer thread and one consumer thread
+ * Capacity must be a power of two, Push fails when the queue is full instead of waiting
+ */
+template <typename T, size_t Capacity>
+class SPSCRing {
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "The ring capacity must be a power of two");
+
+    SPSCRing() : head(0), tail(0) {}
+
+    /**
+     * Add an item, from the producer thread only
+     * @return false if the ring is full
+     */
+    bool Push(const T &item) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[currentTail & (Capacity - 1)] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Take the oldest item, from the consumer thread only
+     * @return false if the ring is empty
+     */
+    bool Pop(T &item) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(items[currentHead & (Capacity - 1)]);
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity];
+    std::atomic<size_t> head; // Next item to pop, only written by the consumer
+    std::atomic<size_t> tail; // Next slot to push to, only written by the producer
+};
+
+const size_t FMOD_COMMAND_RING_SIZE = 1024;
+const size_t FMOD_NOTIFICATION_RING_SIZE = 64;
+
+enum FMODNotificationType {
+    FMODNotification_BankLoaded,
+    FMODNotification_EventPrefetched,
+    FMODNotification_Log, // A console line, the engine console can only be printed to from the game thread
+};
+
+/**
+ * @brief Something the audio thread tells the game thread about, so the forwards are fired from the game frame
+ */
+struct FMODNotification {
+    FMODNotificationType type;
+    std::string name; // Bank name, event path, or console line
+    int error;
+};
+
+enum FMODTimelineRecordType {
+    FMODTimeline_Marker,
+    FMODTimeline_Beat,
+};
+
+const size_t FMOD_TIMELINE_RING_SIZE = 256;
+const size_t FMOD_TIMELINE_MARKER_NAME_SIZE = 64;
+
+/**
+ * @brief A timeline marker or beat reached by the started event, recorded from FMOD's thread without allocating
+ */
+struct FMODTimelineRecord {
+    FMODTimelineRecordType type;
+    int eventHandle;
+    int position; // In milliseconds
+    int bar; // Beats only
+    int beat;
+    float tempo; // In beats per minute
+    int timeSignatureUpper;
+    int timeSignatureLower;
+    char markerName[FMOD_TIMELINE_MARKER_NAME_SIZE]; // Markers only, truncated if longer
+};
+
+const size_t FMOD_SNAPSHOT_EVENT_PATH_SIZE = 256;
+
+/**
+ * @brief FMOD's own performance counters, sampled by the audio thread every amm_telemetry_interval
+ */
+struct FMODTelemetrySample {
+    unsigned int sample; // Number of samples taken, 0 before the first one
+    float time; // Seconds since the audio thread started
+    float studioUpdateCPU; // Percentages of a core, from Studio::System::getCPUUsage
+    float coreUpdateCPU;
+    float dspCPU;
+    float streamCPU;
+    FMOD_STUDIO_BUFFER_INFO commandQueue; // Since the previous sample, stalls mean the audio thread waited on a full buffer
+    FMOD_STUDIO_BUFFER_INFO handles;
+    int memoryExclusive; // Bytes, from Studio::System::getMemoryUsage
+    int memoryInclusive;
+    int sampleDataBytes;
+    long long sampleBytesRead; // Since the start, from System::getFileUsage
+    long long streamBytesRead;
+    long long otherBytesRead;
+};
+
+/**
+ * @brief The state of the playback as published by the audio thread after each update
+ * Plain data only, it's published and read as words of memory
+ */
+struct FMODStateSnapshot {
+    unsigned int update; // Number of updates the audio thread went through
+    int startedEventHandle; // -1 when no event is started
+    char startedEventPath[FMOD_SNAPSHOT_EVENT_PATH_SIZE]; // Empty when no event is started, truncated if longer
+    int timelinePosition; // In milliseconds, -1 when no event is running
+    FMOD_STUDIO_PLAYBACK_STATE playbackState; // FMOD_STUDIO_PLAYBACK_STOPPED when no event is running
+    bool paused; // Paused state of the master bus
+    float volume; // Volume of the master bus
+    int residentBanks;
+    int pendingBankLoads;
+    int pendingEventPrefetches;
+    FMODTelemetrySample telemetry; // Only changes every amm_telemetry_interval
+};
+
+#define FMOD_SNAPSHOT_WORDS ((sizeof(FMODStateSnapshot) + sizeof(unsigned int) - 1) / sizeof(unsigned int))
+
+/**
+ * @brief A global parameter name registered by a native or the audio thread, with what the audio thread last published about it
+ */
+struct FMODParameterRegistration {
+    std::string name;
+    bool resolved; // Whether the parameter exists in the loaded banks and its value is known
+    float value; // Value FMOD holds, while it's resolved
+};
+
+/**
+ * @brief A global parameter as the audio thread sees it, its FMOD ID is resolved whenever a bank is loaded
+ */
+struct FMODParameterEntry {
+    std::string name;
+    FMOD_STUDIO_PARAMETER_ID id;
+    bool resolved; // Whether the parameter exists in the loaded banks
+    float value; // Value last applied by the extension
+    bool valueApplied; // Whether FMOD still holds that value, so setting it again can be skipped
+    bool reported; // Whether a set was already dropped because the parameter doesn't exist in the loaded banks
+};
+
+/**
+ * @brief Shapes of the global parameter ramps, as exposed to plugins
+ */
+enum FMODRampCurve {
+    FMODRamp_Linear,
+    FMODRamp_Exponential, // Slow start, fast end
+    FMODRamp_SCurve, // Slow start and end
+    FMODRamp_CurveCount,
+};
+
+/**
+ * @brief A global parameter moving towards a value, advanced by the audio thread on every update
+ */
+struct FMODParameterRamp {
+    int parameterHandle;
+    FMODRampCurve curve;
+    float startValue;
+    float targetValue;
+    float duration; // In seconds
+    float elapsed;
+};
+
+/**
+ * @brief Where the sample data prefetch of an event stands, as exposed to plugins
+ */
+enum FMODPrefetchState {
+    FMODPrefetch_None,
+    FMODPrefetch_Loading,
+    FMODPrefetch_Loaded,
+    FMODPrefetch_Error,
+};
+
+/**
+ * @brief An event path registered by a native or the audio thread, with the prefetch state the audio thread last published
+ */
+struct FMODEventRegistration {
+    std::string path; // Without the "event:/" prefix
+    FMODPrefetchState prefetchState;
+};
+
+/**
+ * @brief An event as the audio thread sees it, its description is cached when the bank containing it is loaded
+ */
+struct FMODEventEntry {
+    std::string path; // Without the "event:/" prefix
+    FMOD::Studio::EventDescription *description; // nullptr while the event isn't in a loaded bank
+    FMOD::Studio::Bank *bank; // Bank the description was cached from
+    FMODPrefetchState prefetchState;
+    bool sampleDataRequested; // Whether the prefetch holds a loadSampleData reference on the description
+};
+
+/**
+ * @brief A bank resident in memory with its .strings counterpart
+ */
+struct FMODBankResidency {
+    std::string bankName;
+    FMOD::Studio::Bank *bank;
+    FMODBankMemory bankMemory;
+    FMOD::Studio::Bank *stringsBank;
+    FMODBankMemory stringsBankMemory;
+    unsigned int memorySize; // Size of both bank files, in bytes
+    int references; // Active events keeping the bank resident
+    unsigned int lastUse; // Use counter value when the bank was last loaded or used, for the LRU unloading
+};
+
+const unsigned int AMM_MEMORY_SIZE_CLASSES[] = {16, 32, 64, 128, 256, 512, 1024, 2048, 4096}; // Block sizes of the FMOD memory pools
+const int AMM_MEMORY_SIZE_CLASS_COUNT = sizeof(AMM_MEMORY_SIZE_CLASSES) / sizeof(AMM_MEMORY_SIZE_CLASSES[0]);
+
+/**
+ * @brief Counters of the memory allocated by FMOD, in bytes as requested by FMOD
+ */
+struct FMODMemoryStats {
+    size_t currentBytes;
+    size_t peakBytes;
+    size_t reservedBytes; // Arenas allocated for the pools
+    unsigned int allocations; // Since the start
+    unsigned int liveAllocations;
+    unsigned int failedAllocations; // Over the cap or out of memory
+    unsigned int classAllocations[AMM_MEMORY_SIZE_CLASS_COUNT]; // Live blocks of each pool
+};
+
+enum FMODMixerType {
+    FMODMixer_Bus,
+    FMODMixer_VCA,
+};
+
+/**
+ * @brief A bus or VCA path registered by a native or the audio thread, with the volume the audio thread last published
+ */
+struct FMODMixerRegistration {
+    std::string path; // Full path, with the "bus:/" or "vca:/" prefix
+    FMODMixerType type;
+    float volume;
+};
+
+/**
+ * @brief A bus or VCA as the audio thread sees it, its FMOD handle is cached while its bank is loaded
+ */
+struct FMODMixerEntry {
+    std::string path; // Full path, with the "bus:/" or "vca:/" prefix
+    FMODMixerType type;
+    FMOD::Studio::Bus *bus; // nullptr if it's a VCA or not resolved
+    FMOD::Studio::VCA *vca; // nullptr if it's a bus or not resolved
+    FMOD::Studio::Bank *bank; // Bank listing the bus or VCA, nullptr if it was resolved by path only
+    float volume; // Volume last applied by the extension, or to apply once resolved
+    float fadeStartVolume;
+    float fadeTargetVolume;
+    float fadeDuration; // In seconds
+    float fadeElapsed;
+    bool fading;
+};
+
+/**
+ * @brief A file opened by FMOD through the game file system
+ */
+struct FMODFile {
+    std::string name;
+    FileHandle_t handle;
+    unsigned int size;
+    char *readAheadBuffer; // Allocated on the first small read
+    unsigned int readAheadOffset; // Offset in the file of the read-ahead buffer contents
+    unsigned int readAheadLength;
+};
+
+/**
+ * @brief An FMOD read waiting for the I/O thread
+ */
+struct FMODFileReadRequest {
+    FMOD_ASYNCREADINFO *info;
+    std::chrono::steady_clock::time_point queuedTime;
+};
+
+/**
+ * @brief Read statistics of a file, latencies go from the FMOD request to its completion
+ */
+struct FMODFileReadStats {
+    unsigned int reads;
+    unsigned int readAheadHits;
+    unsigned long long bytesRead;
+    unsigned long long totalLatency; // In microseconds
+    unsigned int maxLatency; // In microseconds
+};
+
+/**
+ * @brief Where FMOD sends its mix, chosen with -amm_output on the command line
+ */
+enum FMODOutputMode {
+    FMODOutput_Default, // The sound device
+    FMODOutput_NoSound, // Mixed in real time by FMOD's mixer thread, then discarded
+    FMODOutput_NoSoundNRT, // Mixed by the audio thread's updates only, one block at a time and paced on the real time
+    FMODOutput_WavWriter, // Mixed in real time to a .wav file
+};
+
+/**
+ * @brief A global parameter change of an amm_render script
+ */
+struct FMODRenderScriptEntry {
+    float time; // In seconds from the start of the render
+    std::string parameterName;
+    float value;
+};
+
+const uint32_t MUSIC_STATE_MAGIC = 0x534D4D41; // "AMMS" at the start of a binary .musicstate.sav file
+const uint32_t MUSIC_STATE_VERSION = 1;
+const uint32_t MUSIC_STATE_AUTOSAVE_MANIFEST_MAGIC = 0x414D4D41; // "AMMA" at the start of the autosave manifest
+const int MUSIC_STATE_AUTOSAVE_SLOTS = 100; // autosave and autosave01 to autosave99
+#define MUSIC_STATE_AUTOSAVE_MANIFEST "autosave.musicstate.manifest"
+
+/**
+ * @brief A global parameter value saved in a music state
+ */
+struct MusicStateParameter {
+    std::string name;
+    float value;
+};
+
+/**
+ * @brief The Adaptive Music state saved alongside a game save
+ */
+struct MusicState {
+    std::string bankName;
+    std::string eventPath;
+    int timelinePosition; // -1 when no event was running
+    std::vector<MusicStateParameter> parameters;
+};
+
+/**
+ * @brief An encoded music state waiting for the writer thread
+ */
+struct MusicStateWrite {
+    std::string saveName; // Name of the .musicstate.sav file in the save folder
+    std::vector<char> buffer;
+    bool autosave; // Goes to the next autosave slot, picked by the writer so a failed write never takes one
+    unsigned int sequence; // Tells the cache which save the written file holds
+};
+
+const size_t MUSIC_STATE_CACHE_SIZE = 8;
+
+/**
+ * @brief An encoded music state kept in memory, so reloading the same save doesn't go to the disk
+ */
+struct MusicStateCacheEntry {
+    std::string saveName;
+    long fileTime; // Modification time of the file holding this state, 0 while it's not written yet
+    unsigned int writeSequence; // Sequence of the write putting this state on disk, 0 if it was read from disk
+    std::vector<char> buffer;
+    unsigned int lastUse;
+};
+
+const int AMM_LATENCY_BUCKET_COUNT = 32; // Bucket i holds the durations from 2^i to 2^(i+1) nanoseconds
+
+/**
+ * @brief Durations of an instrumented native or operation, recorded from any thread without locking
+ */
+struct FMODLatencyHistogram {
+    FMODLatencyHistogram(const char *name);
+
+    void Record(unsigned long long nanoseconds);
+
+    void Reset();
+
+    const char *name;
+    std::atomic<unsigned long long> calls;
+    std::atomic<unsigned long long> totalNanoseconds;
+    std::atomic<unsigned long long> maxNanoseconds;
+    std::atomic<unsigned int> buckets[AMM_LATENCY_BUCKET_COUNT];
+};
+
+/**
+ * @brief Records the time spent in its scope into a histogram
+ */
+struct FMODLatencyTimer {
+    FMODLatencyTimer(FMODLatencyHistogram &histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+    ~FMODLatencyTimer() {
+        histogram.Record((unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    FMODLatencyHistogram &histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Time the rest of the scope, the histogram is registered for amm_stats on the first call
+#define AMM_TIME_SCOPE(name) \
+    static FMODLatencyHistogram ammLatencyHistogram(name); \
+    FMODLatencyTimer ammLatencyTimer(ammLatencyHistogram)
+
 /**
  * @brief Adaptive Music implementation of the SDK Extension.
  * Note: Uncomment one of the pre-defined virtual functions in order to use it.
  */
-class AdaptiveMusicExt : public SDKExtension
+class AdaptiveMusicExt : public SDKExtension, public IConCommandBaseAccessor
 {
 public:
 	/**
@@ -119,25 +583,131 @@ public:
 	 */
 	//virtual bool SDK_OnMetamodPauseChange(bool paused, char *error, size_t maxlen);
 
+	/**
+	 * @brief Called by ConVar_Register to register the extension's ConVars and ConCommands.
+	 */
+	virtual bool RegisterConCommandBase(ConCommandBase *pCommandBase);
+
 public:
 	void Hook_GameFrame(bool simulating);
 
 public:
 	// Global interfaces
 	IFileSystem *filesystem;
+	ConVar *musicVolumeConVar; // snd_musicvolume, nullptr where it doesn't exist (dedicated servers)
+
+	// Forwards
+	IForward *bankLoadedForward; // OnFMODBankLoaded(const char[] bankName, int error)
+	IForward *eventPrefetchedForward; // OnFMODEventPrefetched(const char[] eventPath, int error)
+	IForward *timelineMarkerForward; // OnFMODTimelineMarker(const char[] eventPath, const char[] markerName, int position)
+	IForward *beatForward; // OnFMODBeat(const char[] eventPath, int bar, int beat, int position, float tempo, int timeSignatureUpper, int timeSignatureLower)
 
 public:
 
     // FMOD global variables
     FMOD::Studio::System *fmodStudioSystem;
-    FMOD::Studio::Bank *loadedFMODStudioBank;
-    std::string loadedFMODStudioBankName;
-    FMOD::Studio::Bank *loadedFMODStudioStringsBank;
-    FMOD::Studio::EventDescription *startedFMODStudioEventDescription;
+    FMODOutputMode fmodOutputMode;
+    std::string fmodOutputFile; // Full path of the .wav file in the WAV writer mode
+    int fmodMaxChannels;
+    std::chrono::steady_clock::time_point fmodMixStart; // When the non-realtime mix started
+    unsigned long long fmodMixedBlocks; // Blocks mixed since then, in the non-realtime mode
+    double fmodMixBlockTime; // Duration of a mixed block, in seconds
+    std::vector<FMODBankResidency> residentFMODBanks; // Loaded banks, from the least to the most recently loaded
+    unsigned int fmodBankUseCounter;
+    std::string loadedFMODStudioBankName; // Most recently loaded bank
+    int startedFMODEventHandle; // -1 when no event is started
     std::string startedFMODStudioEventPath;
     FMOD::Studio::EventInstance *createdFMODStudioEventInstance;
     bool knownFMODPausedState;
 	int restoredTimelinePosition; // The position
+    std::vector<FMODBankLoad> pendingFMODBankLoads; // Banks being loaded in non-blocking mode
+    std::vector<FMODBankMemoryRelease> pendingFMODBankMemoryReleases; // Memory of the banks being unloaded
+    int queuedFMODEventHandle; // Event requested while banks were still loading, started once they're ready
+    SPSCRing<FMODCommand, FMOD_COMMAND_RING_SIZE> fmodCommandRing; // Operations requested by the natives, for the audio thread
+    std::vector<FMODCommand> overflowFMODCommands; // Operations that didn't fit in the ring, pushed again from the game frame
+    std::vector<FMODCommand> executingFMODCommands; // Operations being executed by the current update of the audio thread
+    std::vector<int> batchedFMODParameterHandles; // Global parameters set by the current update, applied in a single FMOD call
+    std::vector<float> batchedFMODParameterValues;
+    std::vector<FMODParameterRamp> activeFMODParameterRamps; // Kept packed, finished ramps are replaced by the last one
+    std::chrono::steady_clock::time_point lastFMODParameterRampUpdate;
+    SPSCRing<FMODNotification, FMOD_NOTIFICATION_RING_SIZE> fmodNotificationRing; // Completed loads and prefetches, for the game thread
+    std::deque<FMODNotification> overflowFMODNotifications; // Notifications that didn't fit in the ring, pushed again on the next update
+    std::thread fmodWorkerThread; // Audio thread owning the FMOD Studio System
+    std::mutex fmodRegistryMutex; // Guards the registries and what the audio thread publishes in them, never held during an FMOD call
+    std::mutex fmodWorkerWakeMutex;
+    std::condition_variable fmodWorkerWake;
+    bool fmodWorkerRunning;
+    SPSCRing<FMODTimelineRecord, FMOD_TIMELINE_RING_SIZE> fmodTimelineRing; // Markers and beats, from FMOD's thread to the game thread
+    std::atomic<unsigned int> droppedFMODTimelineRecords; // Markers and beats that didn't fit in the ring
+    int timelineEventHandle; // Event whose path is in timelineEventPath, game thread only
+    std::string timelineEventPath;
+    std::atomic<unsigned int> fmodSnapshotSequence; // Odd while the snapshot is being published
+    std::atomic<unsigned int> fmodSnapshotWords[FMOD_SNAPSHOT_WORDS]; // The published FMODStateSnapshot, copied word by word so readers racing the audio thread stay defined
+    unsigned int fmodSnapshotUpdate; // Number of the last published snapshot, audio thread only
+    FMODTelemetrySample fmodTelemetry; // Latest sample, audio thread only
+    std::chrono::steady_clock::time_point fmodWorkerStart;
+    std::chrono::steady_clock::time_point lastFMODTelemetrySample;
+    FileHandle_t telemetryLogHandle; // logs/amm_telemetry.csv, game thread only
+    unsigned int telemetryLogSize;
+    unsigned int lastLoggedFMODTelemetrySample;
+    std::vector<FMODEventRegistration> fmodEventRegistry; // Registered events, indexed by handle, guarded by the registry mutex
+    std::unordered_map<std::string, int> fmodEventHandles; // Event handles, by path, guarded by the registry mutex
+    std::atomic<int> fmodEventCount; // Registered events, for the natives to check handles without the lock
+    std::vector<FMODEventEntry> fmodEvents; // Events, indexed by handle, audio thread only
+    std::vector<int> pendingFMODEventPrefetches; // Handles of the events whose sample data is loading
+    std::vector<FMODParameterRegistration> fmodParameterRegistry; // Registered global parameters, indexed by handle, guarded by the registry mutex
+    std::unordered_map<std::string, int> fmodParameterHandles; // Global parameter handles, by name, guarded by the registry mutex
+    std::atomic<int> fmodParameterCount;
+    std::vector<FMODParameterEntry> fmodParameters; // Global parameters, indexed by handle, audio thread only
+    std::vector<FMODMixerRegistration> fmodMixerRegistry; // Registered buses and VCAs, indexed by handle, guarded by the registry mutex
+    std::unordered_map<std::string, int> fmodMixerHandles; // Bus and VCA handles, by full path, guarded by the registry mutex
+    std::atomic<int> fmodMixerCount;
+    std::vector<FMODMixerEntry> fmodMixers; // Buses and VCAs, indexed by handle, audio thread only
+    std::vector<std::string> fmodBankRegistry; // Names of the banks the natives asked for, indexed by handle, guarded by the registry mutex
+    std::unordered_map<std::string, int> fmodBankHandles; // Bank handles, by name, guarded by the registry mutex
+    std::vector<std::string> publishedResidentFMODBanks; // Resident banks as last published by the audio thread, guarded by the registry mutex
+    std::string publishedLoadedFMODBankName; // Most recently loaded bank as last published by the audio thread, guarded by the registry mutex
+    bool residentFMODBanksChanged; // Whether the resident banks changed since they were last published, audio thread only
+    int checkedFMODParameterCount; // Registered Parameters the audio thread already tried to resolve
+    int checkedFMODMixerCount; // Registered buses and VCAs the audio thread already tried to resolve
+    std::vector<int> fadingFMODMixers; // Handles of the buses and VCAs being faded
+    std::chrono::steady_clock::time_point lastFMODMixerUpdate;
+    int masterBusHandle;
+    bool fmodMemoryInitialized; // FMOD allocates through the pools below
+    bool fmodMemoryReleased; // The arenas are gone, pooled blocks FMOD still frees are left alone
+    std::atomic<size_t> fmodMemoryCap; // In bytes, from amm_memory_cap (0 = no cap)
+    std::mutex fmodMemoryMutex; // Guards the pools and statistics, FMOD allocates from its own threads
+    void *fmodMemoryFreeLists[AMM_MEMORY_SIZE_CLASS_COUNT]; // Freed blocks of each pool, chained through their headers
+    std::vector<char *> fmodMemoryChunks; // Arenas the pooled blocks are carved from
+    std::unordered_set<void *> fmodMemoryHeapBlocks; // Live blocks from the heap, still known once the arenas are gone
+    char *fmodMemoryChunkCursor;
+    size_t fmodMemoryChunkRemaining;
+    FMODMemoryStats fmodMemoryStats;
+    std::thread fmodFileThread; // I/O thread serving the FMOD reads
+    std::mutex fmodFileMutex; // Guards the read queue and statistics
+    std::condition_variable fmodFileRequestAdded;
+    std::condition_variable fmodFileRequestDone;
+    std::deque<FMODFileReadRequest> fmodFileReadRequests;
+    FMOD_ASYNCREADINFO *fmodFileReadInProgress;
+    bool fmodFileThreadRunning;
+    std::unordered_map<std::string, FMODFileReadStats> fmodFileReadStats; // Read statistics, by file name
+    std::thread musicStateWriterThread; // Writes the music states off the save hook
+    std::mutex musicStateWriterMutex; // Guards the music state write queue
+    std::condition_variable musicStateWriteAdded;
+    std::condition_variable musicStateWriteDone;
+    std::deque<MusicStateWrite> pendingMusicStateWrites; // The front one is being written
+    std::vector<std::string> musicStateWriteMessages; // Outcome of the finished writes, printed by the game frame
+    bool musicStateWriterRunning;
+    bool musicStateAutosaveManifestLoaded;
+    int musicStateAutosaveHead; // Slot of the most recent autosave on disk, guarded by the writer mutex
+    int musicStateAutosaveCount; // Slots holding an autosave, guarded by the writer mutex
+    unsigned int musicStateWriteSequence;
+    std::vector<MusicStateCacheEntry> musicStateCache; // Recently saved or restored music states, guarded by the writer mutex
+    unsigned int musicStateCacheUseCounter;
+    unsigned int musicStateCacheHits;
+    unsigned int musicStateCacheMisses;
+    std::mutex latencyHistogramsMutex; // Guards the list, the histograms themselves are atomic
+    std::vector<FMODLatencyHistogram *> latencyHistograms; // In the order they were first used
 
 	int StartFMODEngine();
 	
@@ -145,24 +715,187 @@ public:
 
     std::string GetFMODBankPath(const std::string &bankName);
 
-    int LoadFMODBank(const std::string &bankName);
+    std::string GetFMODBankGamePath(const std::string &bankName);
+
+    int LoadFMODBank(const std::string &bankName, bool async = false);
+
+    void PollPendingFMODBankLoads();
+
+    void OnFMODBankLoaded(const FMODBankLoad &loadedBank);
+
+    int UnloadFMODBank(const std::string &bankName);
+
+    int FindResidentFMODBank(const std::string &bankName);
+
+    int FindResidentFMODBank(FMOD::Studio::Bank *bank);
+
+    void TouchResidentFMODBank(int bankIndex);
+
+    void AddResidentFMODBank(const FMODBankLoad &loadedBank);
+
+    unsigned int GetFMODBankFileSize(const std::string &bankName);
+
+    bool ReadFMODBankFile(const std::string &bankName, FMODBankMemory *memory);
+
+    void FreeFMODBankMemory(FMODBankMemory *memory);
+
+    FMOD_RESULT LoadFMODBankFile(const std::string &bankName, FMOD_STUDIO_LOAD_BANK_FLAGS loadFlags, FMOD::Studio::Bank **bank, FMODBankMemory *memory);
+
+    void UnloadFMODBankFile(FMOD::Studio::Bank *bank, const FMODBankMemory &memory);
+
+    void PollPendingFMODBankMemoryReleases();
+
+    void InitializeFMODMemory();
+
+    void ReleaseFMODMemory();
+
+    void *AllocateFMODMemory(unsigned int size);
+
+    void *ReallocateFMODMemory(void *ptr, unsigned int size);
+
+    void FreeFMODMemory(void *ptr);
+
+    int GetFMODMixerHandle(const std::string &mixerPath, FMODMixerType type);
+
+    bool ResolveFMODMixer(FMODMixerEntry &mixer);
+
+    void ResolveNewFMODRegistryEntries();
+
+    void SyncFMODRegistryEntries();
+
+    void PublishFMODRegistry();
+
+    int GetFMODBankHandle(const std::string &bankName);
+
+    void CacheFMODBankMixers(FMOD::Studio::Bank *bank);
+
+    void UncacheFMODBankMixers(FMOD::Studio::Bank *bank);
+
+    FMOD::Studio::Bus *GetFMODBus(int mixerHandle);
+
+    void SetFMODMixerVolume(int mixerHandle, float volume, float fadeTime);
+
+    int SetFMODBusPaused(int mixerHandle, bool pausedState);
+
+    void UpdateFMODMixerFades();
+
+    FMOD_RESULT ConfigureFMODOutput(FMOD_STUDIO_INITFLAGS *studioFlags, FMOD_INITFLAGS *coreFlags);
+
+    void StartFMODMixClock();
+
+    int GetDueFMODMixBlocks();
+
+    int RenderFMODOutput(float duration, const std::string &outputFile, const std::vector<FMODRenderScriptEntry> &script);
+
+    FMOD_RESULT StartFMODFileSystem();
+
+    void StopFMODFileSystem();
+
+    void QueueFMODFileRead(FMOD_ASYNCREADINFO *info);
+
+    FMOD_RESULT CancelFMODFileRead(FMOD_ASYNCREADINFO *info);
+
+    void RunFMODFileThread();
+
+    FMOD_RESULT ReadFMODFile(FMOD_ASYNCREADINFO *info, bool *readAheadHit);
+
+    void AddFMODBankReference(FMOD::Studio::Bank *bank);
+
+    void ReleaseFMODBankReference(FMOD::Studio::Bank *bank);
+
+    void UncacheFMODBankEvents(FMOD::Studio::Bank *bank);
+
+    void EnforceFMODBankMemoryBudget();
 	
     int StartFMODEvent(const std::string &eventPath);
 
+    int StartFMODEventByHandle(int eventHandle);
+
 	int GetCurrentFMODTimelinePosition();
 
 	void SetCurrentFMODTimelinePosition(int timelinePosition);
 
     int StopFMODEvent(const std::string &eventPath);
 
+    int StopFMODEventByHandle(int eventHandle);
+
+    int GetFMODEventHandle(const std::string &eventPath);
+
+    bool ResolveFMODEvent(FMODEventEntry &event);
+
+    void CacheFMODBankEvents(FMOD::Studio::Bank *bank);
+
+    void PrefetchFMODEvent(int eventHandle);
+
+    void ReleaseFMODEventPrefetch(int eventHandle);
+
+    FMOD_RESULT RequestFMODEventSampleData(FMODEventEntry &event);
+
+    void PollPendingFMODEventPrefetches();
+
     int SetFMODGlobalParameter(const std::string &parameterName, float value);
 
-	std::vector<FMOD_STUDIO_PARAMETER_DESCRIPTION> AdaptiveMusicExt::GetAllFMODGlobalParameters();
+    int SetFMODGlobalParameterByHandle(int parameterHandle, float value);
+
+    int SetFMODGlobalParametersByHandle(const int *parameterHandles, const float *values, int count);
+
+
+    int GetFMODParameterHandle(const std::string &parameterName);
+
+    bool ResolveFMODParameter(FMODParameterEntry &parameter);
+
+    void ResolveFMODParameters();
+
+	std::vector<FMOD_STUDIO_PARAMETER_DESCRIPTION> GetAllFMODGlobalParameters();
+
+    void StartFMODParameterRamp(int parameterHandle, float targetValue, float duration, FMODRampCurve curve);
+
+    void CancelFMODParameterRamp(int parameterHandle);
+
+    void UpdateFMODParameterRamps();
 
     int SetFMODPausedState(bool pausedState);
 
 	int SetFMODVolume(float volume);
 
+	void QueueFMODCommand(FMODCommandType type, int eventHandle);
+
+	void QueueFMODCommand(FMODCommandType type, int parameterHandle, float value, float fadeTime = 0.0f, FMODRampCurve curve = FMODRamp_Linear);
+
+	void FlushOverflowFMODCommands();
+
+	void ExecuteQueuedFMODCommands();
+
+	void ExecuteFMODCommands(size_t begin, size_t end);
+
+    void StartFMODWorker();
+
+    void StopFMODWorker();
+
+    void RunFMODWorker();
+
+    void UpdateFMODWorker();
+
+    void PushFMODNotification(FMODNotificationType type, const std::string &name, int error);
+
+    void LogFMODMessage(const char *format, ...);
+
+    void FireFMODNotifications();
+
+    void SetFMODTimelineCallbacks(FMOD::Studio::EventInstance *eventInstance, int eventHandle);
+
+    void FireFMODTimelineRecords();
+
+    void PublishFMODStateSnapshot();
+
+    FMODStateSnapshot GetFMODStateSnapshot();
+
+    void SampleFMODTelemetry();
+
+    void WriteFMODTelemetryLog();
+
+    void CloseFMODTelemetryLog();
+
 #endif
 };
 
@@ -0,0 +1,335 @@
+#include "extension.h"
+
+#include <filesystem.h>
+
+ConVar amm_bank_memory_budget("amm_bank_memory_budget", "0", FCVAR_NONE,
+                              "Memory budget of the resident FMOD banks, in megabytes. Least recently used banks without active events get unloaded to stay under it (0 = no budget)",
+                              true, 0.0f, false, 0.0f);
+ConVar amm_bank_streaming("amm_bank_streaming", "0", FCVAR_NONE,
+                          "Let FMOD read the bank files through the I/O thread instead of loading them whole into memory, streamed assets are then read from disk as they play. Non-blocking loads always go through the I/O thread",
+                          true, 0.0f, true, 1.0f);
+
+/**
+ * Get the handle of an FMOD Bank name, for the bank operations queued for the audio thread
+ * Must be called with the registry mutex held
+ * @param bankName The name of the FMOD Bank
+ * @return The handle of the bank name
+ */
+int AdaptiveMusicExt::GetFMODBankHandle(const std::string &bankName) {
+    auto it = fmodBankHandles.find(bankName);
+    if (it != fmodBankHandles.end()) {
+        return it->second;
+    }
+    int bankHandle = (int) fmodBankRegistry.size();
+    fmodBankRegistry.push_back(bankName);
+    fmodBankHandles[bankName] = bankHandle;
+    return bankHandle;
+}
+
+/**
+ * Find a resident bank by name
+ * @param bankName The name of the FMOD Bank
+ * @return The index of the bank in residentFMODBanks, or -1 if it's not loaded
+ */
+int AdaptiveMusicExt::FindResidentFMODBank(const std::string &bankName) {
+    for (size_t i = 0; i < residentFMODBanks.size(); i++) {
+        if (residentFMODBanks[i].bankName == bankName) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Find a resident bank from its FMOD handle
+ * @param bank The FMOD Bank
+ * @return The index of the bank in residentFMODBanks, or -1 if it's not loaded
+ */
+int AdaptiveMusicExt::FindResidentFMODBank(FMOD::Studio::Bank *bank) {
+    for (size_t i = 0; i < residentFMODBanks.size(); i++) {
+        if (residentFMODBanks[i].bank == bank) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Mark a resident bank as the most recently used one
+ * @param bankIndex The index of the bank in residentFMODBanks
+ */
+void AdaptiveMusicExt::TouchResidentFMODBank(int bankIndex) {
+    residentFMODBanks[bankIndex].lastUse = ++fmodBankUseCounter;
+}
+
+/**
+ * Register a loaded bank as resident, or refresh it if it already is
+ * @param loadedBank The loaded FMOD Bank and its .strings counterpart
+ */
+void AdaptiveMusicExt::AddResidentFMODBank(const FMODBankLoad &loadedBank) {
+    int bankIndex = FindResidentFMODBank(loadedBank.bankName);
+    if (bankIndex == -1) {
+        FMODBankResidency residency;
+        residency.bankName = loadedBank.bankName;
+        residency.bank = loadedBank.bank;
+        residency.bankMemory = loadedBank.bankMemory;
+        residency.stringsBank = loadedBank.stringsBank;
+        residency.stringsBankMemory = loadedBank.stringsBankMemory;
+        // Banks held in memory weigh exactly their buffers, the others are counted by their file size
+        residency.memorySize = loadedBank.bankMemory.allocation != nullptr ? loadedBank.bankMemory.length : GetFMODBankFileSize(loadedBank.bankName);
+        residency.memorySize += loadedBank.stringsBankMemory.allocation != nullptr ? loadedBank.stringsBankMemory.length : GetFMODBankFileSize(loadedBank.bankName + ".strings");
+        residency.references = 0;
+        bankIndex = (int) residentFMODBanks.size();
+        residentFMODBanks.push_back(residency);
+        residentFMODBanksChanged = true;
+    }
+    TouchResidentFMODBank(bankIndex);
+}
+
+/**
+ * Get the size of a bank file, used as its memory footprint for the budget
+ * @param bankName The name of the FMOD Bank
+ * @return The size of the bank file in bytes, 0 if it can't be found
+ */
+unsigned int AdaptiveMusicExt::GetFMODBankFileSize(const std::string &bankName) {
+    std::string bankPath = GetFMODBankGamePath(bankName);
+    return filesystem->Size(bankPath.c_str(), "GAME");
+}
+
+/**
+ * Read a bank file through the game file system into a buffer owned by the extension
+ * The buffer is aligned for FMOD_STUDIO_LOAD_MEMORY_POINT so FMOD can use it in place without a second copy
+ * @param bankName The name of the FMOD Bank to read
+ * @param memory The buffer to fill, to be freed with FreeFMODBankMemory
+ * @return true if the file was found and read
+ */
+bool AdaptiveMusicExt::ReadFMODBankFile(const std::string &bankName, FMODBankMemory *memory) {
+    std::string bankPath = GetFMODBankGamePath(bankName);
+    FileHandle_t bankFileHandle = filesystem->Open(bankPath.c_str(), "rb", "GAME");
+    if (bankFileHandle == nullptr) {
+        return false;
+    }
+    int length = (int) filesystem->Size(bankFileHandle);
+    memory->allocation = (char *) malloc(length + FMOD_STUDIO_LOAD_MEMORY_ALIGNMENT);
+    if (memory->allocation == nullptr) {
+        filesystem->Close(bankFileHandle);
+        return false;
+    }
+    memory->data = (char *) (((uintptr_t) memory->allocation + FMOD_STUDIO_LOAD_MEMORY_ALIGNMENT - 1) & ~((uintptr_t) FMOD_STUDIO_LOAD_MEMORY_ALIGNMENT - 1));
+    memory->length = filesystem->Read(memory->data, length, bankFileHandle);
+    filesystem->Close(bankFileHandle);
+    if (memory->length != length) {
+        FreeFMODBankMemory(memory);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Free a buffer filled by ReadFMODBankFile
+ * @param memory The buffer to free
+ */
+void AdaptiveMusicExt::FreeFMODBankMemory(FMODBankMemory *memory) {
+    free(memory->allocation);
+    memory->allocation = nullptr;
+    memory->data = nullptr;
+    memory->length = 0;
+}
+
+/**
+ * Load a single bank file, from memory when the game file system can read it and from disk through FMOD otherwise
+ * Non-blocking loads always let FMOD read the file on its I/O thread, so the audio thread never waits for the disk
+ * @param bankName The name of the FMOD Bank to load
+ * @param loadFlags The FMOD loading flags, blocking or not
+ * @param bank The loaded FMOD Bank
+ * @param memory The buffer the bank is loaded from, left empty when FMOD reads the file itself
+ * @return The error code (or FMOD_OK if no error was encountered)
+ */
+FMOD_RESULT AdaptiveMusicExt::LoadFMODBankFile(const std::string &bankName, FMOD_STUDIO_LOAD_BANK_FLAGS loadFlags, FMOD::Studio::Bank **bank, FMODBankMemory *memory) {
+    FMOD_RESULT result;
+    memory->allocation = nullptr;
+    memory->data = nullptr;
+    memory->length = 0;
+    bool blocking = (loadFlags & FMOD_STUDIO_LOAD_BANK_NONBLOCKING) == 0;
+    if (blocking && !amm_bank_streaming.GetBool() && ReadFMODBankFile(bankName, memory)) {
+        result = fmodStudioSystem->loadBankMemory(memory->data, memory->length, FMOD_STUDIO_LOAD_MEMORY_POINT, loadFlags, bank);
+        if (result != FMOD_OK) {
+            FreeFMODBankMemory(memory);
+        }
+        return result;
+    }
+    // FMOD opens the file through the game file system as well, the mod folder path is only needed outside of the search paths
+    std::string bankPath = GetFMODBankGamePath(bankName);
+    if (!filesystem->FileExists(bankPath.c_str(), "GAME")) {
+        bankPath = GetFMODBankPath(bankName);
+    }
+    result = fmodStudioSystem->loadBankFile(bankPath.c_str(), loadFlags, bank);
+    return result;
+}
+
+/**
+ * Unload a single bank file, its buffer is freed once FMOD is done unloading it
+ * @param bank The FMOD Bank to unload
+ * @param memory The buffer the bank was loaded from, if any
+ */
+void AdaptiveMusicExt::UnloadFMODBankFile(FMOD::Studio::Bank *bank, const FMODBankMemory &memory) {
+    bank->unload();
+    if (memory.allocation != nullptr) {
+        pendingFMODBankMemoryReleases.push_back({bank, memory});
+    }
+}
+
+/**
+ * Free the buffers of the banks FMOD is done unloading
+ */
+void AdaptiveMusicExt::PollPendingFMODBankMemoryReleases() {
+    for (size_t i = 0; i < pendingFMODBankMemoryReleases.size();) {
+        FMODBankMemoryRelease &release = pendingFMODBankMemoryReleases[i];
+        // Once unloaded the handle is invalid, which is just as final as the UNLOADED state
+        FMOD_STUDIO_LOADING_STATE loadingState;
+        FMOD_RESULT result = release.bank->getLoadingState(&loadingState);
+        if (result == FMOD_OK && loadingState != FMOD_STUDIO_LOADING_STATE_UNLOADED) {
+            i++;
+            continue;
+        }
+        FreeFMODBankMemory(&release.memory);
+        pendingFMODBankMemoryReleases.erase(pendingFMODBankMemoryReleases.begin() + i);
+    }
+}
+
+/**
+ * Keep a bank resident while an event or a prefetch uses it
+ * @param bank The FMOD Bank in use, can be nullptr for events that weren't cached from a bank
+ */
+void AdaptiveMusicExt::AddFMODBankReference(FMOD::Studio::Bank *bank) {
+    int bankIndex = FindResidentFMODBank(bank);
+    if (bankIndex != -1) {
+        residentFMODBanks[bankIndex].references++;
+        TouchResidentFMODBank(bankIndex);
+    }
+}
+
+/**
+ * Release a reference taken with AddFMODBankReference, the bank can then be unloaded to stay under the budget
+ * @param bank The FMOD Bank no longer in use, can be nullptr for events that weren't cached from a bank
+ */
+void AdaptiveMusicExt::ReleaseFMODBankReference(FMOD::Studio::Bank *bank) {
+    int bankIndex = FindResidentFMODBank(bank);
+    if (bankIndex != -1 && residentFMODBanks[bankIndex].references > 0) {
+        residentFMODBanks[bankIndex].references--;
+        EnforceFMODBankMemoryBudget();
+    }
+}
+
+/**
+ * Unload a resident FMOD Bank and its .strings counterpart, stopping the started event if it comes from it
+ * A load of the bank still in progress in non-blocking mode is cancelled
+ * @param bankName The name of the FMOD Bank to unload
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::UnloadFMODBank(const std::string &bankName) {
+    bool cancelledLoad = false;
+    for (size_t i = 0; i < pendingFMODBankLoads.size();) {
+        const FMODBankLoad &pendingLoad = pendingFMODBankLoads[i];
+        if (pendingLoad.bankName != bankName) {
+            i++;
+            continue;
+        }
+        UnloadFMODBankFile(pendingLoad.bank, pendingLoad.bankMemory);
+        UnloadFMODBankFile(pendingLoad.stringsBank, pendingLoad.stringsBankMemory);
+        pendingFMODBankLoads.erase(pendingFMODBankLoads.begin() + i);
+        LogFMODMessage("AMM Extension - Loading of the FMOD bank cancelled: %s\n", bankName.c_str());
+        cancelledLoad = true;
+    }
+    int bankIndex = FindResidentFMODBank(bankName);
+    if (bankIndex == -1 && cancelledLoad) {
+        return 0;
+    }
+    if (bankIndex == -1) {
+        LogFMODMessage("AMM Extension - FMOD bank requested for unloading but not loaded: %s\n", bankName.c_str());
+        return -1;
+    }
+    FMOD::Studio::Bank *bank = residentFMODBanks[bankIndex].bank;
+    if (startedFMODEventHandle != -1 && fmodEvents[startedFMODEventHandle].bank == bank) {
+        StopFMODEventByHandle(startedFMODEventHandle);
+    }
+    UncacheFMODBankEvents(bank);
+
+    // Stopping the event may have unloaded banks to fit the budget, this one included
+    bankIndex = FindResidentFMODBank(bankName);
+    if (bankIndex == -1) {
+        return 0;
+    }
+    FMODBankResidency residency = residentFMODBanks[bankIndex];
+    residentFMODBanks.erase(residentFMODBanks.begin() + bankIndex);
+    residentFMODBanksChanged = true;
+    UnloadFMODBankFile(residency.bank, residency.bankMemory);
+    UnloadFMODBankFile(residency.stringsBank, residency.stringsBankMemory);
+    LogFMODMessage("AMM Extension - Bank successfully unloaded: %s\n", bankName.c_str());
+
+    if (loadedFMODStudioBankName == bankName) {
+        loadedFMODStudioBankName = residentFMODBanks.empty() ? "" : residentFMODBanks.back().bankName;
+    }
+    ResolveFMODParameters();
+    UncacheFMODBankMixers(bank);
+    return 0;
+}
+
+/**
+ * Forget the cached descriptions of the Events of a bank about to be unloaded
+ * @param bank The FMOD Bank
+ */
+void AdaptiveMusicExt::UncacheFMODBankEvents(FMOD::Studio::Bank *bank) {
+    for (FMODEventEntry &event : fmodEvents) {
+        if (event.bank == bank) {
+            event.description = nullptr;
+            event.bank = nullptr;
+            // The sample data goes away with the bank, pending prefetches will fail once they find the event is gone
+            if (event.sampleDataRequested) {
+                event.sampleDataRequested = false;
+                if (event.prefetchState == FMODPrefetch_Loaded) {
+                    event.prefetchState = FMODPrefetch_None;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Unload the least recently used banks without active events until the resident banks fit in amm_bank_memory_budget
+ * The most recently used bank always stays, even if it doesn't fit on its own
+ */
+void AdaptiveMusicExt::EnforceFMODBankMemoryBudget() {
+    unsigned int budget = (unsigned int) (amm_bank_memory_budget.GetFloat() * 1024.0f * 1024.0f);
+    if (budget == 0) {
+        return;
+    }
+    while (true) {
+        unsigned int residentSize = 0;
+        unsigned int mostRecentUse = 0;
+        for (const FMODBankResidency &residency : residentFMODBanks) {
+            residentSize += residency.memorySize;
+            mostRecentUse = std::max(mostRecentUse, residency.lastUse);
+        }
+        if (residentSize <= budget) {
+            return;
+        }
+        int evictedBankIndex = -1;
+        for (size_t i = 0; i < residentFMODBanks.size(); i++) {
+            const FMODBankResidency &residency = residentFMODBanks[i];
+            if (residency.references > 0 || residency.lastUse == mostRecentUse) {
+                continue;
+            }
+            if (evictedBankIndex == -1 || residency.lastUse < residentFMODBanks[evictedBankIndex].lastUse) {
+                evictedBankIndex = (int) i;
+            }
+        }
+        if (evictedBankIndex == -1) {
+            LogFMODMessage("AMM Extension - Resident FMOD banks use %u bytes, over the %u bytes budget, but all of them are in use\n", residentSize, budget);
+            return;
+        }
+        std::string evictedBankName = residentFMODBanks[evictedBankIndex].bankName;
+        LogFMODMessage("AMM Extension - Unloading least recently used bank to stay under the memory budget: %s\n", evictedBankName.c_str());
+        UnloadFMODBank(evictedBankName);
+    }
+}
@@ -0,0 +1,236 @@
+#include "extension.h"
+
+#include <filesystem.h>
+
+#define AMM_FILE_READ_QUEUE_SIZE 32 // Reads waiting for the I/O thread before FMOD's stream thread gets held back
+#define AMM_FILE_READ_AHEAD_SIZE (64 * 1024) // Bytes read past each small request, served to the next sequential reads
+
+/**
+ * FMOD open callback, opens the file through the game file system so VPKs and custom mounts are searched too
+ */
+FMOD_RESULT F_CALL FMODFileOpenCallback(const char *name, unsigned int *filesize, void **handle, void *userdata) {
+    FileHandle_t fileHandle = g_AdaptiveMusicExt.filesystem->Open(name, "rb", "GAME");
+    if (fileHandle == nullptr) {
+        return FMOD_ERR_FILE_NOTFOUND;
+    }
+    FMODFile *file = new FMODFile;
+    file->name = name;
+    file->handle = fileHandle;
+    file->size = g_AdaptiveMusicExt.filesystem->Size(fileHandle);
+    file->readAheadBuffer = nullptr;
+    file->readAheadOffset = 0;
+    file->readAheadLength = 0;
+    *filesize = file->size;
+    *handle = file;
+    return FMOD_OK;
+}
+
+/**
+ * FMOD close callback, FMOD cancels the reads of a file before closing it
+ */
+FMOD_RESULT F_CALL FMODFileCloseCallback(void *handle, void *userdata) {
+    FMODFile *file = (FMODFile *) handle;
+    g_AdaptiveMusicExt.filesystem->Close(file->handle);
+    free(file->readAheadBuffer);
+    delete file;
+    return FMOD_OK;
+}
+
+/**
+ * FMOD asynchronous read callback, hands the read over to the I/O thread
+ */
+FMOD_RESULT F_CALL FMODFileAsyncReadCallback(FMOD_ASYNCREADINFO *info, void *userdata) {
+    g_AdaptiveMusicExt.QueueFMODFileRead(info);
+    return FMOD_OK;
+}
+
+/**
+ * FMOD read cancel callback, called before a file is closed or a stream released
+ */
+FMOD_RESULT F_CALL FMODFileAsyncCancelCallback(FMOD_ASYNCREADINFO *info, void *userdata) {
+    return g_AdaptiveMusicExt.CancelFMODFileRead(info);
+}
+
+/**
+ * Route the FMOD file accesses through the game file system and start the I/O thread serving them
+ * Must be called before the FMOD Studio System gets initialized
+ * @return The error code (or FMOD_OK if no error was encountered)
+ */
+FMOD_RESULT AdaptiveMusicExt::StartFMODFileSystem() {
+    FMOD::System *fmodCoreSystem = nullptr;
+    FMOD_RESULT result;
+    result = fmodStudioSystem->getCoreSystem(&fmodCoreSystem);
+    if (result != FMOD_OK) {
+        return result;
+    }
+    result = fmodCoreSystem->setFileSystem(FMODFileOpenCallback, FMODFileCloseCallback, nullptr, nullptr, FMODFileAsyncReadCallback, FMODFileAsyncCancelCallback, 2048);
+    if (result != FMOD_OK) {
+        return result;
+    }
+    fmodFileReadInProgress = nullptr;
+    fmodFileThreadRunning = true;
+    fmodFileThread = std::thread(&AdaptiveMusicExt::RunFMODFileThread, this);
+    return FMOD_OK;
+}
+
+/**
+ * Stop the I/O thread, once the FMOD Studio System is released and no more reads can come in
+ */
+void AdaptiveMusicExt::StopFMODFileSystem() {
+    if (!fmodFileThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(fmodFileMutex);
+        fmodFileThreadRunning = false;
+    }
+    fmodFileRequestAdded.notify_all();
+    fmodFileThread.join();
+}
+
+/**
+ * Queue a read for the I/O thread, waiting for room if the queue is full
+ * @param info The FMOD read request
+ */
+void AdaptiveMusicExt::QueueFMODFileRead(FMOD_ASYNCREADINFO *info) {
+    std::unique_lock<std::mutex> lock(fmodFileMutex);
+    fmodFileRequestDone.wait(lock, [this] { return fmodFileReadRequests.size() < AMM_FILE_READ_QUEUE_SIZE; });
+    FMODFileReadRequest request;
+    request.info = info;
+    request.queuedTime = std::chrono::steady_clock::now();
+    fmodFileReadRequests.push_back(request);
+    lock.unlock();
+    fmodFileRequestAdded.notify_one();
+}
+
+/**
+ * Cancel a read, waiting for it if the I/O thread is already serving it
+ * @param info The FMOD read request
+ * @return FMOD_ERR_FILE_DISKEJECTED if the read was dropped, FMOD_OK if it already completed
+ */
+FMOD_RESULT AdaptiveMusicExt::CancelFMODFileRead(FMOD_ASYNCREADINFO *info) {
+    std::unique_lock<std::mutex> lock(fmodFileMutex);
+    for (auto it = fmodFileReadRequests.begin(); it != fmodFileReadRequests.end(); ++it) {
+        if (it->info == info) {
+            fmodFileReadRequests.erase(it);
+            lock.unlock();
+            fmodFileRequestDone.notify_all();
+            info->done(info, FMOD_ERR_FILE_DISKEJECTED);
+            return FMOD_ERR_FILE_DISKEJECTED;
+        }
+    }
+    fmodFileRequestDone.wait(lock, [this, info] { return fmodFileReadInProgress != info; });
+    return FMOD_OK;
+}
+
+/**
+ * Body of the I/O thread, serves the queued reads by priority until the FMOD file system is stopped
+ */
+void AdaptiveMusicExt::RunFMODFileThread() {
+    std::unique_lock<std::mutex> lock(fmodFileMutex);
+    while (true) {
+        fmodFileRequestAdded.wait(lock, [this] { return !fmodFileReadRequests.empty() || !fmodFileThreadRunning; });
+        if (fmodFileReadRequests.empty()) {
+            break;
+        }
+        // Streams ask with a higher priority than sample data, serve them first
+        auto next = fmodFileReadRequests.begin();
+        for (auto it = fmodFileReadRequests.begin(); it != fmodFileReadRequests.end(); ++it) {
+            if (it->info->priority > next->info->priority) {
+                next = it;
+            }
+        }
+        FMODFileReadRequest request = *next;
+        fmodFileReadRequests.erase(next);
+        fmodFileReadInProgress = request.info;
+        lock.unlock();
+        fmodFileRequestDone.notify_all();
+
+        bool readAheadHit = false;
+        FMOD_RESULT result = ReadFMODFile(request.info, &readAheadHit);
+        unsigned int latency = (unsigned int) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - request.queuedTime).count();
+
+        lock.lock();
+        // The file can be closed as soon as FMOD is told the read is done, so it's accounted before that
+        FMODFileReadStats &stats = fmodFileReadStats[((FMODFile *) request.info->handle)->name];
+        stats.reads++;
+        stats.readAheadHits += readAheadHit ? 1 : 0;
+        stats.bytesRead += request.info->bytesread;
+        stats.totalLatency += latency;
+        if (latency > stats.maxLatency) {
+            stats.maxLatency = latency;
+        }
+        lock.unlock();
+        request.info->done(request.info, result);
+        lock.lock();
+        fmodFileReadInProgress = nullptr;
+        fmodFileRequestDone.notify_all();
+    }
+}
+
+/**
+ * Serve a read from the read-ahead buffer of its file, or from the game file system
+ * Only ever called from the I/O thread, which owns the file handles and read-ahead buffers while the files are open
+ * @param info The FMOD read request, its buffer and bytesread get filled
+ * @param readAheadHit Set to true if the read was served from the read-ahead buffer
+ * @return The error code (or FMOD_OK if no error was encountered)
+ */
+FMOD_RESULT AdaptiveMusicExt::ReadFMODFile(FMOD_ASYNCREADINFO *info, bool *readAheadHit) {
+    FMODFile *file = (FMODFile *) info->handle;
+    unsigned int offset = info->offset;
+    unsigned int sizeBytes = info->sizebytes;
+    if (offset >= file->size) {
+        info->bytesread = 0;
+        return FMOD_ERR_FILE_EOF;
+    }
+    if (offset >= file->readAheadOffset && offset + sizeBytes <= file->readAheadOffset + file->readAheadLength) {
+        memcpy(info->buffer, file->readAheadBuffer + (offset - file->readAheadOffset), sizeBytes);
+        info->bytesread = sizeBytes;
+        *readAheadHit = true;
+        return FMOD_OK;
+    }
+    filesystem->Seek(file->handle, offset, FILESYSTEM_SEEK_HEAD);
+    if (sizeBytes >= AMM_FILE_READ_AHEAD_SIZE) {
+        // Large enough on its own, read straight into FMOD's buffer
+        int bytesRead = filesystem->Read(info->buffer, sizeBytes, file->handle);
+        info->bytesread = bytesRead > 0 ? bytesRead : 0;
+    } else {
+        if (file->readAheadBuffer == nullptr) {
+            file->readAheadBuffer = (char *) malloc(AMM_FILE_READ_AHEAD_SIZE);
+            if (file->readAheadBuffer == nullptr) {
+                info->bytesread = 0;
+                return FMOD_ERR_MEMORY;
+            }
+        }
+        unsigned int readAheadSize = file->size - offset < AMM_FILE_READ_AHEAD_SIZE ? file->size - offset : AMM_FILE_READ_AHEAD_SIZE;
+        int bytesRead = filesystem->Read(file->readAheadBuffer, readAheadSize, file->handle);
+        file->readAheadOffset = offset;
+        file->readAheadLength = bytesRead > 0 ? bytesRead : 0;
+        info->bytesread = file->readAheadLength < sizeBytes ? file->readAheadLength : sizeBytes;
+        memcpy(info->buffer, file->readAheadBuffer, info->bytesread);
+    }
+    if (info->bytesread < sizeBytes) {
+        return FMOD_ERR_FILE_EOF;
+    }
+    return FMOD_OK;
+}
+
+/**
+ * Print the read statistics of the files FMOD went through, to tune the stream buffering
+ */
+CON_COMMAND(amm_filestats, "Print the read statistics of the files read by FMOD (amm_filestats reset to clear them)") {
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodFileMutex);
+    if (args.ArgC() > 1 && strcmp(args.Arg(1), "reset") == 0) {
+        g_AdaptiveMusicExt.fmodFileReadStats.clear();
+        META_CONPRINTF("AMM Extension - File read statistics cleared\n");
+        return;
+    }
+    META_CONPRINTF("AMM Extension - File read statistics (%d files)\n", (int) g_AdaptiveMusicExt.fmodFileReadStats.size());
+    for (const auto &fileStats : g_AdaptiveMusicExt.fmodFileReadStats) {
+        const FMODFileReadStats &stats = fileStats.second;
+        META_CONPRINTF("  %s: %u reads (%u from read-ahead), %llu KB, latency avg %.2f ms, max %.2f ms\n",
+                       fileStats.first.c_str(), stats.reads, stats.readAheadHits, stats.bytesRead / 1024,
+                       stats.reads > 0 ? stats.totalLatency / 1000.0 / stats.reads : 0.0, stats.maxLatency / 1000.0);
+    }
+}
@@ -0,0 +1,270 @@
+#include "extension.h"
+
+#define AMM_MEMORY_HEADER_SIZE 16 // Keeps the blocks handed to FMOD 16 bytes aligned
+#define AMM_MEMORY_ALIGNMENT 16
+#define AMM_MEMORY_CHUNK_SIZE (64 * 1024) // Size of the arenas the pooled blocks are carved from
+#define AMM_MEMORY_LARGE_CLASS -1
+
+void OnFMODMemoryCapChanged(IConVar *var, const char *pOldValue, float flOldValue);
+
+ConVar amm_memory_cap("amm_memory_cap", "0", FCVAR_NONE,
+                      "Hard cap on the memory FMOD can allocate, in megabytes. Allocations over it fail and FMOD reports FMOD_ERR_MEMORY (0 = no cap)",
+                      true, 0.0f, false, 0.0f, OnFMODMemoryCapChanged);
+
+/**
+ * amm_memory_cap change callback, the cap is checked by every allocation from FMOD's threads so it's kept in an atomic
+ */
+void OnFMODMemoryCapChanged(IConVar *var, const char *pOldValue, float flOldValue) {
+    g_AdaptiveMusicExt.fmodMemoryCap = (size_t) (amm_memory_cap.GetFloat() * 1024.0f * 1024.0f);
+}
+
+/**
+ * @brief Placed right before every block handed to FMOD
+ */
+struct FMODMemoryHeader {
+    unsigned int size; // Size requested by FMOD
+    int sizeClass; // Index in AMM_MEMORY_SIZE_CLASSES, or AMM_MEMORY_LARGE_CLASS
+    void *allocation; // What to free for large blocks, the next free block for pooled ones in a free list
+};
+
+static_assert(sizeof(FMODMemoryHeader) <= AMM_MEMORY_HEADER_SIZE, "The FMOD memory header must fit before the aligned block");
+
+/**
+ * Helper function to align a pointer up to AMM_MEMORY_ALIGNMENT
+ */
+char *AlignFMODMemory(char *pointer) {
+    return (char *) (((uintptr_t) pointer + AMM_MEMORY_ALIGNMENT - 1) & ~((uintptr_t) AMM_MEMORY_ALIGNMENT - 1));
+}
+
+/**
+ * Helper function to find the smallest size class fitting a size
+ * @return The index of the size class, or AMM_MEMORY_LARGE_CLASS if it's too big for the pools
+ */
+int GetFMODMemorySizeClass(unsigned int size) {
+    for (int i = 0; i < AMM_MEMORY_SIZE_CLASS_COUNT; i++) {
+        if (size <= AMM_MEMORY_SIZE_CLASSES[i]) {
+            return i;
+        }
+    }
+    return AMM_MEMORY_LARGE_CLASS;
+}
+
+/**
+ * FMOD allocation callback
+ */
+void *F_CALL AllocateFMODMemory(unsigned int size, FMOD_MEMORY_TYPE type, const char *sourcestr) {
+    return g_AdaptiveMusicExt.AllocateFMODMemory(size);
+}
+
+/**
+ * FMOD reallocation callback
+ */
+void *F_CALL ReallocateFMODMemory(void *ptr, unsigned int size, FMOD_MEMORY_TYPE type, const char *sourcestr) {
+    return g_AdaptiveMusicExt.ReallocateFMODMemory(ptr, size);
+}
+
+/**
+ * FMOD free callback
+ */
+void F_CALL FreeFMODMemory(void *ptr, FMOD_MEMORY_TYPE type, const char *sourcestr) {
+    g_AdaptiveMusicExt.FreeFMODMemory(ptr);
+}
+
+/**
+ * Route all the FMOD allocations through the extension's pools
+ * FMOD only accepts it before its first system is created, and keeps the callbacks for as long as its library is loaded
+ * The FMOD library is loaded and unloaded along with the extension, so each load of the extension hands them to a fresh FMOD
+ * If FMOD outlived a previous load of the extension it refuses them, and keeps using the process heap
+ */
+void AdaptiveMusicExt::InitializeFMODMemory() {
+    if (fmodMemoryInitialized) {
+        return;
+    }
+    fmodMemoryReleased = false;
+    OnFMODMemoryCapChanged(&amm_memory_cap, amm_memory_cap.GetString(), amm_memory_cap.GetFloat());
+    for (int i = 0; i < AMM_MEMORY_SIZE_CLASS_COUNT; i++) {
+        fmodMemoryFreeLists[i] = nullptr;
+        fmodMemoryStats.classAllocations[i] = 0;
+    }
+    fmodMemoryChunkCursor = nullptr;
+    fmodMemoryChunkRemaining = 0;
+    fmodMemoryStats.currentBytes = 0;
+    fmodMemoryStats.peakBytes = 0;
+    fmodMemoryStats.reservedBytes = 0;
+    fmodMemoryStats.allocations = 0;
+    fmodMemoryStats.liveAllocations = 0;
+    fmodMemoryStats.failedAllocations = 0;
+    FMOD_RESULT result;
+    result = FMOD::Memory_Initialize(nullptr, 0, ::AllocateFMODMemory, ::ReallocateFMODMemory, ::FreeFMODMemory, FMOD_MEMORY_ALL);
+    if (result != FMOD_OK) {
+        META_CONPRINTF("AMM Extension - Could not set up the FMOD memory pools, FMOD uses the process heap (%d): %s\n", result,
+                       FMOD_ErrorString(result));
+        return;
+    }
+    fmodMemoryInitialized = true;
+}
+
+/**
+ * Give back the arenas of the pools, once FMOD is released
+ * Pooled blocks FMOD still holds by then are never used again, freeing them later does nothing and new ones come from the heap
+ * Blocks from the heap stay freeable and resizable
+ */
+void AdaptiveMusicExt::ReleaseFMODMemory() {
+    std::lock_guard<std::mutex> lock(fmodMemoryMutex);
+    if (fmodMemoryStats.liveAllocations != 0) {
+        META_CONPRINTF("AMM Extension - FMOD still holds %u allocations, releasing the memory pools anyway\n", fmodMemoryStats.liveAllocations);
+    }
+    fmodMemoryReleased = true;
+    for (char *chunk : fmodMemoryChunks) {
+        free(chunk);
+    }
+    fmodMemoryChunks.clear();
+    for (int i = 0; i < AMM_MEMORY_SIZE_CLASS_COUNT; i++) {
+        fmodMemoryFreeLists[i] = nullptr;
+    }
+    fmodMemoryChunkCursor = nullptr;
+    fmodMemoryChunkRemaining = 0;
+    fmodMemoryStats.reservedBytes = 0;
+}
+
+/**
+ * Allocate a block for FMOD, from the pool of its size class or from the heap for the large ones
+ * @param size The size requested by FMOD
+ * @return The block, or nullptr if it would go over amm_memory_cap or the heap is exhausted
+ */
+void *AdaptiveMusicExt::AllocateFMODMemory(unsigned int size) {
+    size_t cap = fmodMemoryCap.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(fmodMemoryMutex);
+    if (cap != 0 && fmodMemoryStats.currentBytes + size > cap) {
+        fmodMemoryStats.failedAllocations++;
+        return nullptr;
+    }
+    // Once the pools are released, whatever FMOD still allocates comes from the heap
+    int sizeClass = fmodMemoryReleased ? AMM_MEMORY_LARGE_CLASS : GetFMODMemorySizeClass(size);
+    FMODMemoryHeader *header;
+    if (sizeClass == AMM_MEMORY_LARGE_CLASS) {
+        char *allocation = (char *) malloc(AMM_MEMORY_HEADER_SIZE + size + AMM_MEMORY_ALIGNMENT - 1);
+        if (allocation == nullptr) {
+            fmodMemoryStats.failedAllocations++;
+            return nullptr;
+        }
+        header = (FMODMemoryHeader *) AlignFMODMemory(allocation);
+        header->allocation = allocation;
+        fmodMemoryHeapBlocks.insert((char *) header + AMM_MEMORY_HEADER_SIZE);
+    } else if (fmodMemoryFreeLists[sizeClass] != nullptr) {
+        header = (FMODMemoryHeader *) fmodMemoryFreeLists[sizeClass];
+        fmodMemoryFreeLists[sizeClass] = header->allocation;
+    } else {
+        size_t blockSize = AMM_MEMORY_HEADER_SIZE + AMM_MEMORY_SIZE_CLASSES[sizeClass];
+        if (fmodMemoryChunkRemaining < blockSize) {
+            // The end of the current arena is left unused, it's smaller than the block
+            char *chunk = (char *) malloc(AMM_MEMORY_CHUNK_SIZE + AMM_MEMORY_ALIGNMENT - 1);
+            if (chunk == nullptr) {
+                fmodMemoryStats.failedAllocations++;
+                return nullptr;
+            }
+            fmodMemoryChunks.push_back(chunk);
+            fmodMemoryChunkCursor = AlignFMODMemory(chunk);
+            fmodMemoryChunkRemaining = AMM_MEMORY_CHUNK_SIZE;
+            fmodMemoryStats.reservedBytes += AMM_MEMORY_CHUNK_SIZE;
+        }
+        header = (FMODMemoryHeader *) fmodMemoryChunkCursor;
+        fmodMemoryChunkCursor += blockSize;
+        fmodMemoryChunkRemaining -= blockSize;
+    }
+    header->size = size;
+    header->sizeClass = sizeClass;
+    fmodMemoryStats.currentBytes += size;
+    if (fmodMemoryStats.currentBytes > fmodMemoryStats.peakBytes) {
+        fmodMemoryStats.peakBytes = fmodMemoryStats.currentBytes;
+    }
+    fmodMemoryStats.allocations++;
+    fmodMemoryStats.liveAllocations++;
+    if (sizeClass != AMM_MEMORY_LARGE_CLASS) {
+        fmodMemoryStats.classAllocations[sizeClass]++;
+    }
+    return (char *) header + AMM_MEMORY_HEADER_SIZE;
+}
+
+/**
+ * Resize a block for FMOD, in place when the new size stays in the same size class
+ * @param ptr The block to resize, nullptr to allocate a new one
+ * @param size The new size requested by FMOD
+ * @return The resized block, or nullptr if it couldn't be resized (the original block is then left as it is)
+ */
+void *AdaptiveMusicExt::ReallocateFMODMemory(void *ptr, unsigned int size) {
+    if (ptr == nullptr) {
+        return AllocateFMODMemory(size);
+    }
+    {
+        std::lock_guard<std::mutex> lock(fmodMemoryMutex);
+        if (fmodMemoryReleased && fmodMemoryHeapBlocks.count(ptr) == 0) {
+            // Nothing tells how big a pooled block was anymore, see FreeFMODMemory
+            return nullptr;
+        }
+    }
+    FMODMemoryHeader *header = (FMODMemoryHeader *) ((char *) ptr - AMM_MEMORY_HEADER_SIZE);
+    int sizeClass = GetFMODMemorySizeClass(size);
+    if (sizeClass != AMM_MEMORY_LARGE_CLASS && sizeClass == header->sizeClass) {
+        std::lock_guard<std::mutex> lock(fmodMemoryMutex);
+        fmodMemoryStats.currentBytes = fmodMemoryStats.currentBytes - header->size + size;
+        if (fmodMemoryStats.currentBytes > fmodMemoryStats.peakBytes) {
+            fmodMemoryStats.peakBytes = fmodMemoryStats.currentBytes;
+        }
+        header->size = size;
+        return ptr;
+    }
+    void *newPtr = AllocateFMODMemory(size);
+    if (newPtr == nullptr) {
+        return nullptr;
+    }
+    memcpy(newPtr, ptr, header->size < size ? header->size : size);
+    FreeFMODMemory(ptr);
+    return newPtr;
+}
+
+/**
+ * Give a block back to the pool of its size class, or to the heap for the large ones
+ * @param ptr The block to free
+ */
+void AdaptiveMusicExt::FreeFMODMemory(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(fmodMemoryMutex);
+    if (fmodMemoryReleased && fmodMemoryHeapBlocks.count(ptr) == 0) {
+        // The block was carved from an arena that's gone, even its header can't be read
+        return;
+    }
+    FMODMemoryHeader *header = (FMODMemoryHeader *) ((char *) ptr - AMM_MEMORY_HEADER_SIZE);
+    fmodMemoryStats.currentBytes -= header->size;
+    fmodMemoryStats.liveAllocations--;
+    if (header->sizeClass == AMM_MEMORY_LARGE_CLASS) {
+        fmodMemoryHeapBlocks.erase(ptr);
+        free(header->allocation);
+        return;
+    }
+    fmodMemoryStats.classAllocations[header->sizeClass]--;
+    header->allocation = fmodMemoryFreeLists[header->sizeClass];
+    fmodMemoryFreeLists[header->sizeClass] = header;
+}
+
+/**
+ * Print how much memory FMOD uses, and how it's spread over the pools
+ */
+CON_COMMAND(amm_memstats, "Print the memory statistics of FMOD") {
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.fmodMemoryMutex);
+    const FMODMemoryStats &stats = g_AdaptiveMusicExt.fmodMemoryStats;
+    if (!g_AdaptiveMusicExt.fmodMemoryInitialized) {
+        META_CONPRINTF("AMM Extension - FMOD uses the process heap, no memory statistics\n");
+        return;
+    }
+    META_CONPRINTF("AMM Extension - FMOD memory: %.2f MB current, %.2f MB peak, cap %s\n",
+                   stats.currentBytes / 1048576.0, stats.peakBytes / 1048576.0,
+                   amm_memory_cap.GetFloat() > 0.0f ? amm_memory_cap.GetString() : "none");
+    META_CONPRINTF("  %u allocations, %u live, %u failed, %.2f MB reserved by the pools\n",
+                   stats.allocations, stats.liveAllocations, stats.failedAllocations, stats.reservedBytes / 1048576.0);
+    for (int i = 0; i < AMM_MEMORY_SIZE_CLASS_COUNT; i++) {
+        META_CONPRINTF("  %5u bytes pool: %u live blocks\n", AMM_MEMORY_SIZE_CLASSES[i], stats.classAllocations[i]);
+    }
+}
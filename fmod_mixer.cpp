@@ -0,0 +1,285 @@
+#include "extension.h"
+
+/**
+ * Get the handle of a bus or VCA, registering it if it's the first time it's asked for
+ * Handles stay valid for the whole session, even if the bus or VCA doesn't exist in the loaded banks yet
+ * Registering doesn't call FMOD, the audio thread resolves the new buses and VCAs before executing the next commands
+ * Must be called with the registry mutex held
+ * @param mixerPath The path of the bus or VCA, without the "bus:/" or "vca:/" prefix ("" for the master bus)
+ * @param type Whether it's a bus or a VCA
+ * @return The handle of the bus or VCA
+ */
+int AdaptiveMusicExt::GetFMODMixerHandle(const std::string &mixerPath, FMODMixerType type) {
+    std::string fullMixerPath = (type == FMODMixer_Bus ? "bus:/" : "vca:/") + mixerPath;
+    auto it = fmodMixerHandles.find(fullMixerPath);
+    if (it != fmodMixerHandles.end()) {
+        return it->second;
+    }
+    FMODMixerRegistration registration;
+    registration.path = fullMixerPath;
+    registration.type = type;
+    registration.volume = 1.0f;
+    int mixerHandle = (int) fmodMixerRegistry.size();
+    fmodMixerRegistry.push_back(registration);
+    fmodMixerHandles[fullMixerPath] = mixerHandle;
+    fmodMixerCount = (int) fmodMixerRegistry.size();
+    return mixerHandle;
+}
+
+/**
+ * Look up the FMOD handle of a single registered bus or VCA by its path, and give it the volume the extension holds for it
+ * A volume set or faded while the bus or VCA wasn't loaded is applied this way
+ * @param mixer The registered bus or VCA to resolve
+ * @return true if the bus or VCA exists in the loaded banks
+ */
+bool AdaptiveMusicExt::ResolveFMODMixer(FMODMixerEntry &mixer) {
+    FMOD_RESULT result;
+    if (mixer.type == FMODMixer_Bus) {
+        result = fmodStudioSystem->getBus(mixer.path.c_str(), &mixer.bus);
+        if (result != FMOD_OK) {
+            mixer.bus = nullptr;
+            return false;
+        }
+        mixer.bus->setVolume(mixer.volume);
+    } else {
+        result = fmodStudioSystem->getVCA(mixer.path.c_str(), &mixer.vca);
+        if (result != FMOD_OK) {
+            mixer.vca = nullptr;
+            return false;
+        }
+        mixer.vca->setVolume(mixer.volume);
+    }
+    return true;
+}
+
+/**
+ * Give the audio thread its own entry for each event, global Parameter, bus and VCA registered since it last looked
+ * The registrations are only copied, so the natives registering names never wait for an FMOD call
+ * Must be called from the audio thread, with the registry mutex held
+ */
+void AdaptiveMusicExt::SyncFMODRegistryEntries() {
+    for (size_t i = fmodEvents.size(); i < fmodEventRegistry.size(); i++) {
+        FMODEventEntry event;
+        event.path = fmodEventRegistry[i].path;
+        event.description = nullptr;
+        event.bank = nullptr;
+        event.prefetchState = FMODPrefetch_None;
+        event.sampleDataRequested = false;
+        fmodEvents.push_back(event);
+    }
+    for (size_t i = fmodParameters.size(); i < fmodParameterRegistry.size(); i++) {
+        FMODParameterEntry parameter;
+        parameter.name = fmodParameterRegistry[i].name;
+        parameter.resolved = false;
+        parameter.value = 0.0f;
+        parameter.valueApplied = false;
+        parameter.reported = false;
+        fmodParameters.push_back(parameter);
+    }
+    for (size_t i = fmodMixers.size(); i < fmodMixerRegistry.size(); i++) {
+        FMODMixerEntry mixer;
+        mixer.path = fmodMixerRegistry[i].path;
+        mixer.type = fmodMixerRegistry[i].type;
+        mixer.bus = nullptr;
+        mixer.vca = nullptr;
+        mixer.bank = nullptr;
+        mixer.volume = 1.0f;
+        mixer.fadeStartVolume = 1.0f;
+        mixer.fadeTargetVolume = 1.0f;
+        mixer.fadeDuration = 0.0f;
+        mixer.fadeElapsed = 0.0f;
+        mixer.fading = false;
+        fmodMixers.push_back(mixer);
+    }
+}
+
+/**
+ * Resolve the global Parameters, buses and VCAs registered by the game thread since the last update, from the audio thread
+ */
+void AdaptiveMusicExt::ResolveNewFMODRegistryEntries() {
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        SyncFMODRegistryEntries();
+    }
+    for (int i = checkedFMODParameterCount; i < (int) fmodParameters.size(); i++) {
+        if (!fmodParameters[i].resolved) {
+            ResolveFMODParameter(fmodParameters[i]);
+        }
+    }
+    checkedFMODParameterCount = (int) fmodParameters.size();
+    for (int i = checkedFMODMixerCount; i < (int) fmodMixers.size(); i++) {
+        if (fmodMixers[i].bus == nullptr && fmodMixers[i].vca == nullptr) {
+            ResolveFMODMixer(fmodMixers[i]);
+        }
+    }
+    checkedFMODMixerCount = (int) fmodMixers.size();
+}
+
+/**
+ * Register the buses and VCAs of a freshly loaded bank, so their handles are ready before any plugin asks for them
+ * @param bank The loaded FMOD Bank
+ */
+void AdaptiveMusicExt::CacheFMODBankMixers(FMOD::Studio::Bank *bank) {
+    // The paths are listed first, so the registry mutex isn't held during the FMOD calls
+    std::vector<std::string> busPaths;
+    std::vector<std::string> vcaPaths;
+    int busCount = 0;
+    FMOD_RESULT result;
+    result = bank->getBusCount(&busCount);
+    if (result == FMOD_OK && busCount > 0) {
+        std::vector<FMOD::Studio::Bus *> buses(busCount);
+        result = bank->getBusList(buses.data(), busCount, &busCount);
+        for (int i = 0; result == FMOD_OK && i < busCount; i++) {
+            char busPath[512];
+            if (buses[i]->getPath(busPath, sizeof(busPath), nullptr) == FMOD_OK && strncmp(busPath, "bus:/", 5) == 0) {
+                busPaths.push_back(busPath + 5);
+            }
+        }
+    }
+    int vcaCount = 0;
+    result = bank->getVCACount(&vcaCount);
+    if (result == FMOD_OK && vcaCount > 0) {
+        std::vector<FMOD::Studio::VCA *> vcas(vcaCount);
+        result = bank->getVCAList(vcas.data(), vcaCount, &vcaCount);
+        for (int i = 0; result == FMOD_OK && i < vcaCount; i++) {
+            char vcaPath[512];
+            if (vcas[i]->getPath(vcaPath, sizeof(vcaPath), nullptr) == FMOD_OK && strncmp(vcaPath, "vca:/", 5) == 0) {
+                vcaPaths.push_back(vcaPath + 5);
+            }
+        }
+    }
+    std::vector<int> mixerHandles;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        for (const std::string &busPath : busPaths) {
+            mixerHandles.push_back(GetFMODMixerHandle(busPath, FMODMixer_Bus));
+        }
+        for (const std::string &vcaPath : vcaPaths) {
+            mixerHandles.push_back(GetFMODMixerHandle(vcaPath, FMODMixer_VCA));
+        }
+        SyncFMODRegistryEntries();
+    }
+    for (int mixerHandle : mixerHandles) {
+        fmodMixers[mixerHandle].bank = bank;
+    }
+    // Mixers registered before the bank was loaded can be resolved now, the music volume synced before the master bus existed included
+    for (FMODMixerEntry &mixer : fmodMixers) {
+        if (mixer.bus == nullptr && mixer.vca == nullptr) {
+            ResolveFMODMixer(mixer);
+        }
+    }
+}
+
+/**
+ * Forget the FMOD handles of the buses and VCAs of a bank once it's unloaded, they get resolved again when next used
+ * The ones resolved by path only may belong to it too, so they're forgotten as well
+ * @param bank The unloaded FMOD Bank
+ */
+void AdaptiveMusicExt::UncacheFMODBankMixers(FMOD::Studio::Bank *bank) {
+    for (FMODMixerEntry &mixer : fmodMixers) {
+        if (mixer.bank == bank || mixer.bank == nullptr) {
+            mixer.bus = nullptr;
+            mixer.vca = nullptr;
+            mixer.bank = nullptr;
+        }
+    }
+}
+
+/**
+ * Get the FMOD bus of a registered bus handle, resolving it if needed
+ * @param mixerHandle The handle of the bus, from GetFMODMixerHandle
+ * @return The FMOD bus, or nullptr if it doesn't exist in the loaded banks
+ */
+FMOD::Studio::Bus *AdaptiveMusicExt::GetFMODBus(int mixerHandle) {
+    FMODMixerEntry &mixer = fmodMixers[mixerHandle];
+    if (mixer.type != FMODMixer_Bus) {
+        return nullptr;
+    }
+    if (mixer.bus == nullptr && !ResolveFMODMixer(mixer)) {
+        return nullptr;
+    }
+    return mixer.bus;
+}
+
+/**
+ * Set the volume of a bus or VCA, right away or faded over time by the audio thread
+ * @param mixerHandle The handle of the bus or VCA, from GetFMODMixerHandle
+ * @param volume The volume to reach, 1.0 being the volume set in FMOD Studio
+ * @param fadeTime The time to reach it, in seconds (0 to apply it on the next update)
+ */
+void AdaptiveMusicExt::SetFMODMixerVolume(int mixerHandle, float volume, float fadeTime) {
+    FMODMixerEntry &mixer = fmodMixers[mixerHandle];
+    // A new fade starts from wherever the previous one got to
+    mixer.fadeStartVolume = mixer.volume;
+    mixer.fadeTargetVolume = volume;
+    mixer.fadeDuration = fadeTime > 0.0f ? fadeTime : 0.0f;
+    mixer.fadeElapsed = 0.0f;
+    if (!mixer.fading) {
+        if (fadingFMODMixers.empty()) {
+            // Fades are only advanced while there are some, the time since the last one doesn't count
+            lastFMODMixerUpdate = std::chrono::steady_clock::now();
+        }
+        mixer.fading = true;
+        fadingFMODMixers.push_back(mixerHandle);
+    }
+}
+
+/**
+ * Pause/Unpause a bus
+ * @param mixerHandle The handle of the bus, from GetFMODMixerHandle
+ * @param pausedState true if the bus should be paused, false otherwise
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::SetFMODBusPaused(int mixerHandle, bool pausedState) {
+    if (fmodMixers[mixerHandle].type != FMODMixer_Bus) {
+        LogFMODMessage("AMM Extension - Could not pause %s, only buses can be paused\n", fmodMixers[mixerHandle].path.c_str());
+        return -1;
+    }
+    FMOD::Studio::Bus *bus = GetFMODBus(mixerHandle);
+    if (bus == nullptr) {
+        LogFMODMessage("AMM Extension - Could not find the FMOD bus %s\n", fmodMixers[mixerHandle].path.c_str());
+        return -1;
+    }
+    FMOD_RESULT result;
+    result = bus->setPaused(pausedState);
+    if (result != FMOD_OK) {
+        LogFMODMessage("AMM Extension - Could not pause the FMOD bus %s! (%d) %s\n", fmodMixers[mixerHandle].path.c_str(), result, FMOD_ErrorString(result));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Advance the fades of the buses and VCAs, from the audio thread right before the FMOD update
+ */
+void AdaptiveMusicExt::UpdateFMODMixerFades() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float frameTime = std::chrono::duration<float>(now - lastFMODMixerUpdate).count();
+    lastFMODMixerUpdate = now;
+    for (size_t i = 0; i < fadingFMODMixers.size();) {
+        FMODMixerEntry &mixer = fmodMixers[fadingFMODMixers[i]];
+        mixer.fadeElapsed += frameTime;
+        float volume;
+        if (mixer.fadeElapsed >= mixer.fadeDuration) {
+            volume = mixer.fadeTargetVolume;
+        } else {
+            volume = mixer.fadeStartVolume + (mixer.fadeTargetVolume - mixer.fadeStartVolume) * (mixer.fadeElapsed / mixer.fadeDuration);
+        }
+        // Mixers missing from the loaded banks keep fading, so they're at the right volume if their bank gets loaded
+        bool resolved = mixer.bus != nullptr || mixer.vca != nullptr || ResolveFMODMixer(mixer);
+        mixer.volume = volume;
+        if (resolved) {
+            if (mixer.type == FMODMixer_Bus) {
+                mixer.bus->setVolume(mixer.volume);
+            } else {
+                mixer.vca->setVolume(mixer.volume);
+            }
+        }
+        if (mixer.fadeElapsed >= mixer.fadeDuration) {
+            mixer.fading = false;
+            fadingFMODMixers.erase(fadingFMODMixers.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
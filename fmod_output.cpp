@@ -0,0 +1,272 @@
+#include "extension.h"
+
+#include <filesystem.h>
+#include <tier0/icommandline.h>
+
+#define AMM_MIX_MAX_CATCH_UP_BLOCKS 4 // Blocks mixed at most by a single update when the audio thread falls behind
+
+/**
+ * Pick the FMOD output from the command line, before the FMOD Studio System gets initialized
+ *   -amm_output default|nosound|nosound_nrt|wav (nosound_nrt by default on dedicated servers, default otherwise)
+ *   -amm_output_file <name.wav> for the WAV writer, relative to the game folder
+ *   -amm_channels <count>
+ * @param studioFlags Set to the FMOD Studio initialization flags the output needs
+ * @param coreFlags Set to the FMOD Core initialization flags the output needs
+ * @return The error code (or FMOD_OK if no error was encountered)
+ */
+FMOD_RESULT AdaptiveMusicExt::ConfigureFMODOutput(FMOD_STUDIO_INITFLAGS *studioFlags, FMOD_INITFLAGS *coreFlags) {
+    const char *outputModeName = CommandLine()->ParmValue("-amm_output", engine->IsDedicatedServer() ? "nosound_nrt" : "default");
+    fmodMaxChannels = CommandLine()->ParmValue("-amm_channels", 512);
+    fmodOutputFile.clear();
+    FMOD_OUTPUTTYPE outputType;
+    if (strcmp(outputModeName, "nosound") == 0) {
+        fmodOutputMode = FMODOutput_NoSound;
+        outputType = FMOD_OUTPUTTYPE_NOSOUND;
+    } else if (strcmp(outputModeName, "nosound_nrt") == 0) {
+        fmodOutputMode = FMODOutput_NoSoundNRT;
+        outputType = FMOD_OUTPUTTYPE_NOSOUND_NRT;
+        // Everything happens in the updates of the audio thread, FMOD runs no thread of its own
+        *studioFlags |= FMOD_STUDIO_INIT_SYNCHRONOUS_UPDATE;
+        *coreFlags |= FMOD_INIT_STREAM_FROM_UPDATE;
+    } else if (strcmp(outputModeName, "wav") == 0) {
+        fmodOutputMode = FMODOutput_WavWriter;
+        outputType = FMOD_OUTPUTTYPE_WAVWRITER;
+        fmodOutputFile = std::string(g_SMAPI->GetBaseDir()) + "/" + CommandLine()->ParmValue("-amm_output_file", "amm_output.wav");
+    } else {
+        fmodOutputMode = FMODOutput_Default;
+        return FMOD_OK;
+    }
+    META_CONPRINTF("AMM Extension - FMOD output set to %s\n", outputModeName);
+    FMOD::System *fmodCoreSystem = nullptr;
+    FMOD_RESULT result;
+    result = fmodStudioSystem->getCoreSystem(&fmodCoreSystem);
+    if (result != FMOD_OK) {
+        return result;
+    }
+    return fmodCoreSystem->setOutput(outputType);
+}
+
+/**
+ * Start pacing the non-realtime mix on the real time, once the FMOD Studio System is initialized
+ */
+void AdaptiveMusicExt::StartFMODMixClock() {
+    fmodMixedBlocks = 0;
+    fmodMixBlockTime = 0.0;
+    FMOD::System *fmodCoreSystem = nullptr;
+    int sampleRate = 0;
+    unsigned int blockLength = 0;
+    if (fmodStudioSystem->getCoreSystem(&fmodCoreSystem) == FMOD_OK &&
+        fmodCoreSystem->getSoftwareFormat(&sampleRate, nullptr, nullptr) == FMOD_OK &&
+        fmodCoreSystem->getDSPBufferSize(&blockLength, nullptr) == FMOD_OK && sampleRate > 0) {
+        fmodMixBlockTime = (double) blockLength / sampleRate;
+    }
+    fmodMixStart = std::chrono::steady_clock::now();
+}
+
+/**
+ * Count the FMOD updates the non-realtime mix is due for, each one mixes a single block
+ * @return The number of updates to make now, 0 if the mix is ahead of the real time
+ */
+int AdaptiveMusicExt::GetDueFMODMixBlocks() {
+    if (fmodMixBlockTime <= 0.0) {
+        return 1;
+    }
+    double elapsedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - fmodMixStart).count();
+    unsigned long long dueBlocks = (unsigned long long) (elapsedTime / fmodMixBlockTime);
+    if (dueBlocks <= fmodMixedBlocks) {
+        return 0;
+    }
+    if (dueBlocks - fmodMixedBlocks > AMM_MIX_MAX_CATCH_UP_BLOCKS) {
+        // Too far behind, the blocks that were missed are dropped rather than mixed in a burst
+        fmodMixedBlocks = dueBlocks - AMM_MIX_MAX_CATCH_UP_BLOCKS;
+    }
+    int blocks = (int) (dueBlocks - fmodMixedBlocks);
+    fmodMixedBlocks = dueBlocks;
+    return blocks;
+}
+
+/**
+ * Helper function to load a bank in the render system, from memory when the game file system can read it
+ */
+FMOD_RESULT LoadFMODRenderBank(FMOD::Studio::System *renderSystem, const std::string &bankName, std::vector<FMODBankMemory> &bankMemories) {
+    FMOD::Studio::Bank *bank;
+    FMODBankMemory memory;
+    if (g_AdaptiveMusicExt.ReadFMODBankFile(bankName, &memory)) {
+        bankMemories.push_back(memory);
+        return renderSystem->loadBankMemory(memory.data, memory.length, FMOD_STUDIO_LOAD_MEMORY_POINT, FMOD_STUDIO_LOAD_BANK_NORMAL, &bank);
+    }
+    return renderSystem->loadBankFile(g_AdaptiveMusicExt.GetFMODBankPath(bankName).c_str(), FMOD_STUDIO_LOAD_BANK_NORMAL, &bank);
+}
+
+/**
+ * Render the current music to a .wav file as fast as the CPU allows, in a separate non-realtime FMOD Studio System
+ * The resident banks, started event, timeline position and global parameters are copied from the running playback
+ * @param duration The length to render, in seconds
+ * @param outputFile Full path of the .wav file to write
+ * @param script Global parameter changes to apply during the render, sorted by time
+ * @return The error code (or 0 if no error was encountered)
+ */
+int AdaptiveMusicExt::RenderFMODOutput(float duration, const std::string &outputFile, const std::vector<FMODRenderScriptEntry> &script) {
+    std::vector<std::string> bankNames;
+    std::string eventPath;
+    int timelinePosition = 0;
+    std::vector<std::string> parameterNames;
+    std::vector<float> parameterValues;
+    {
+        // The playback is copied as last published by the audio thread, FMOD isn't called from the game thread
+        FMODStateSnapshot snapshot = GetFMODStateSnapshot();
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        bankNames = publishedResidentFMODBanks;
+        if (snapshot.startedEventHandle != -1) {
+            eventPath = fmodEventRegistry[snapshot.startedEventHandle].path;
+        }
+        if (snapshot.timelinePosition != -1) {
+            timelinePosition = snapshot.timelinePosition;
+        }
+        for (const FMODParameterRegistration &parameter : fmodParameterRegistry) {
+            if (parameter.resolved) {
+                parameterNames.push_back(parameter.name);
+                parameterValues.push_back(parameter.value);
+            }
+        }
+    }
+    if (eventPath.empty()) {
+        META_CONPRINTF("AMM Extension - Nothing to render, no event is started\n");
+        return -1;
+    }
+
+    FMOD::Studio::System *renderSystem = nullptr;
+    FMOD::System *renderCoreSystem = nullptr;
+    FMOD_RESULT result;
+    result = FMOD::Studio::System::create(&renderSystem);
+    if (result == FMOD_OK) {
+        result = renderSystem->getCoreSystem(&renderCoreSystem);
+    }
+    if (result == FMOD_OK) {
+        result = renderCoreSystem->setOutput(FMOD_OUTPUTTYPE_WAVWRITER_NRT);
+    }
+    if (result == FMOD_OK) {
+        result = renderSystem->initialize(fmodMaxChannels, FMOD_STUDIO_INIT_SYNCHRONOUS_UPDATE, FMOD_INIT_STREAM_FROM_UPDATE, (void *) outputFile.c_str());
+    }
+    if (result != FMOD_OK) {
+        META_CONPRINTF("AMM Extension - Could not start the FMOD render system (%d): %s\n", result, FMOD_ErrorString(result));
+        if (renderSystem != nullptr) {
+            renderSystem->release();
+        }
+        return -1;
+    }
+
+    std::vector<FMODBankMemory> bankMemories;
+    for (const std::string &bankName : bankNames) {
+        result = LoadFMODRenderBank(renderSystem, bankName, bankMemories);
+        if (result == FMOD_OK) {
+            result = LoadFMODRenderBank(renderSystem, bankName + ".strings", bankMemories);
+        }
+        if (result != FMOD_OK) {
+            META_CONPRINTF("AMM Extension - Could not load FMOD bank for rendering: %s. Error (%d): %s\n", bankName.c_str(), result, FMOD_ErrorString(result));
+        }
+    }
+    for (size_t i = 0; i < parameterNames.size(); i++) {
+        renderSystem->setParameterByName(parameterNames[i].c_str(), parameterValues[i], true);
+    }
+    FMOD::Studio::EventDescription *eventDescription = nullptr;
+    FMOD::Studio::EventInstance *eventInstance = nullptr;
+    std::string fullEventPath = "event:/" + eventPath;
+    result = renderSystem->getEvent(fullEventPath.c_str(), &eventDescription);
+    if (result == FMOD_OK) {
+        result = eventDescription->createInstance(&eventInstance);
+    }
+    if (result == FMOD_OK) {
+        eventInstance->setTimelinePosition(timelinePosition);
+        result = eventInstance->start();
+    }
+    if (result != FMOD_OK) {
+        META_CONPRINTF("AMM Extension - Could not start Event (%s) for rendering. Error: (%d) %s\n", eventPath.c_str(), result, FMOD_ErrorString(result));
+    }
+    // Every update mixes a single block in the non-realtime output
+    int sampleRate = 0;
+    unsigned int blockLength = 0;
+    bool validFormat = false;
+    if (result == FMOD_OK) {
+        result = renderCoreSystem->getSoftwareFormat(&sampleRate, nullptr, nullptr);
+        if (result == FMOD_OK) {
+            result = renderCoreSystem->getDSPBufferSize(&blockLength, nullptr);
+        }
+        if (result != FMOD_OK) {
+            META_CONPRINTF("AMM Extension - Could not get the FMOD render format (%d): %s\n", result, FMOD_ErrorString(result));
+        } else if (sampleRate <= 0 || blockLength == 0) {
+            META_CONPRINTF("AMM Extension - Invalid FMOD render format (%d Hz, blocks of %u samples)\n", sampleRate, blockLength);
+        } else {
+            validFormat = true;
+        }
+    }
+    if (validFormat) {
+        unsigned long long blocks = (unsigned long long) (duration * sampleRate + blockLength - 1) / blockLength;
+        size_t scriptIndex = 0;
+        std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+        for (unsigned long long block = 0; block < blocks; block++) {
+            float time = (float) (block * blockLength) / sampleRate;
+            while (scriptIndex < script.size() && script[scriptIndex].time <= time) {
+                renderSystem->setParameterByName(script[scriptIndex].parameterName.c_str(), script[scriptIndex].value);
+                scriptIndex++;
+            }
+            renderSystem->update();
+        }
+        double renderTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+        META_CONPRINTF("AMM Extension - Rendered %.2f s of %s to %s in %.3f s (%.1fx real time, %llu blocks of %u samples at %d Hz)\n",
+                       duration, eventPath.c_str(), outputFile.c_str(), renderTime, renderTime > 0.0 ? duration / renderTime : 0.0,
+                       blocks, blockLength, sampleRate);
+    }
+    // Releasing the system unloads the banks and closes the .wav file
+    renderSystem->release();
+    for (FMODBankMemory &memory : bankMemories) {
+        FreeFMODBankMemory(&memory);
+    }
+    return validFormat ? 0 : -1;
+}
+
+/**
+ * Helper function to read an amm_render script, one "<time in seconds> <parameter name> <value>" change per line
+ * @return false if the file couldn't be opened
+ */
+bool ReadFMODRenderScript(const char *scriptPath, std::vector<FMODRenderScriptEntry> &script) {
+    FileHandle_t scriptFileHandle = g_AdaptiveMusicExt.filesystem->Open(scriptPath, "r", "MOD");
+    if (scriptFileHandle == nullptr) {
+        return false;
+    }
+    char line[512];
+    while (g_AdaptiveMusicExt.filesystem->ReadLine(line, sizeof(line), scriptFileHandle) != nullptr) {
+        float time, value;
+        char parameterName[256];
+        if (line[0] == '/' || line[0] == '#' || sscanf(line, "%f %255s %f", &time, parameterName, &value) != 3) {
+            continue;
+        }
+        script.push_back({time, parameterName, value});
+    }
+    g_AdaptiveMusicExt.filesystem->Close(scriptFileHandle);
+    std::stable_sort(script.begin(), script.end(), [](const FMODRenderScriptEntry &a, const FMODRenderScriptEntry &b) { return a.time < b.time; });
+    return true;
+}
+
+/**
+ * Render the current music offline, for regression and performance comparisons
+ */
+CON_COMMAND(amm_render, "Render the started event to a .wav file as fast as possible: amm_render <seconds> <file.wav> [parameter script]") {
+    if (args.ArgC() < 3) {
+        META_CONPRINTF("Usage: amm_render <seconds> <file.wav> [parameter script]\n");
+        META_CONPRINTF("  The script holds one \"<time in seconds> <parameter name> <value>\" change per line\n");
+        return;
+    }
+    float duration = (float) atof(args.Arg(1));
+    if (duration <= 0.0f) {
+        META_CONPRINTF("AMM Extension - Invalid render duration (%s)\n", args.Arg(1));
+        return;
+    }
+    std::vector<FMODRenderScriptEntry> script;
+    if (args.ArgC() > 3 && !ReadFMODRenderScript(args.Arg(3), script)) {
+        META_CONPRINTF("AMM Extension - Failed to open render script for reading: %s\n", args.Arg(3));
+        return;
+    }
+    std::string outputFile = std::string(g_SMAPI->GetBaseDir()) + "/" + args.Arg(2);
+    g_AdaptiveMusicExt.RenderFMODOutput(duration, outputFile, script);
+}
@@ -0,0 +1,102 @@
+#include "extension.h"
+
+/**
+ * Start loading the sample data of an FMOD Event ahead of its first play, so it doesn't start late
+ * Completion is reported through OnFMODEventPrefetched from the game frame, once the audio thread sees it
+ * @param eventHandle The handle of the FMOD Event to prefetch, from GetFMODEventHandle
+ */
+void AdaptiveMusicExt::PrefetchFMODEvent(int eventHandle) {
+    FMODEventEntry &event = fmodEvents[eventHandle];
+    if (event.prefetchState == FMODPrefetch_Loading || event.prefetchState == FMODPrefetch_Loaded) {
+        LogFMODMessage("AMM Extension - Event requested for prefetching but already prefetched (%s)\n", event.path.c_str());
+        return;
+    }
+    // The sample data loading itself begins from the polling, as the event may live in a bank that's still loading
+    event.prefetchState = FMODPrefetch_Loading;
+    pendingFMODEventPrefetches.push_back(eventHandle);
+}
+
+/**
+ * Release the sample data loaded by PrefetchFMODEvent, the bank of the event can then be unloaded again
+ * @param eventHandle The handle of the FMOD Event, from GetFMODEventHandle
+ */
+void AdaptiveMusicExt::ReleaseFMODEventPrefetch(int eventHandle) {
+    FMODEventEntry &event = fmodEvents[eventHandle];
+    pendingFMODEventPrefetches.erase(std::remove(pendingFMODEventPrefetches.begin(), pendingFMODEventPrefetches.end(), eventHandle),
+                                     pendingFMODEventPrefetches.end());
+    event.prefetchState = FMODPrefetch_None;
+    if (event.sampleDataRequested) {
+        event.sampleDataRequested = false;
+        event.description->unloadSampleData();
+        ReleaseFMODBankReference(event.bank);
+        LogFMODMessage("AMM Extension - Event prefetch released (%s)\n", event.path.c_str());
+    }
+}
+
+/**
+ * Request the sample data of a prefetched event and keep its bank resident while it's held
+ * @param event The registered Event to prefetch
+ * @return The error code (or FMOD_OK if no error was encountered)
+ */
+FMOD_RESULT AdaptiveMusicExt::RequestFMODEventSampleData(FMODEventEntry &event) {
+    if (event.description == nullptr && !ResolveFMODEvent(event)) {
+        return FMOD_ERR_EVENT_NOTFOUND;
+    }
+    FMOD_RESULT result;
+    result = event.description->loadSampleData();
+    if (result != FMOD_OK) {
+        return result;
+    }
+    event.sampleDataRequested = true;
+    AddFMODBankReference(event.bank);
+    return FMOD_OK;
+}
+
+/**
+ * Check the events being prefetched and have OnFMODEventPrefetched fired for the ones that are done
+ */
+void AdaptiveMusicExt::PollPendingFMODEventPrefetches() {
+    std::vector<int> finishedPrefetches;
+    std::vector<int> finishedPrefetchErrors;
+    for (size_t i = 0; i < pendingFMODEventPrefetches.size();) {
+        int eventHandle = pendingFMODEventPrefetches[i];
+        FMODEventEntry &event = fmodEvents[eventHandle];
+        FMOD_RESULT result = FMOD_OK;
+        FMOD_STUDIO_LOADING_STATE sampleLoadingState = FMOD_STUDIO_LOADING_STATE_LOADING;
+        if (!event.sampleDataRequested) {
+            if (!pendingFMODBankLoads.empty()) {
+                // Wait for the banks, the event may be in one of them
+                i++;
+                continue;
+            }
+            // Also requested again when the bank of the event got unloaded while its sample data was loading
+            result = RequestFMODEventSampleData(event);
+        } else {
+            result = event.description->getSampleLoadingState(&sampleLoadingState);
+            if (result == FMOD_OK && sampleLoadingState == FMOD_STUDIO_LOADING_STATE_ERROR) {
+                result = FMOD_ERR_FILE_BAD;
+            }
+        }
+        if (result == FMOD_OK && sampleLoadingState != FMOD_STUDIO_LOADING_STATE_LOADED) {
+            i++;
+            continue;
+        }
+        finishedPrefetches.push_back(eventHandle);
+        finishedPrefetchErrors.push_back(result);
+        pendingFMODEventPrefetches.erase(pendingFMODEventPrefetches.begin() + i);
+    }
+
+    for (size_t i = 0; i < finishedPrefetches.size(); i++) {
+        FMODEventEntry &event = fmodEvents[finishedPrefetches[i]];
+        int error = finishedPrefetchErrors[i];
+        if (error != 0) {
+            LogFMODMessage("AMM Extension - Could not prefetch Event (%s). Error: (%d) %s\n", event.path.c_str(), error, FMOD_ErrorString((FMOD_RESULT) error));
+            ReleaseFMODEventPrefetch(finishedPrefetches[i]);
+            event.prefetchState = FMODPrefetch_Error;
+        } else {
+            LogFMODMessage("AMM Extension - Event successfully prefetched (%s)\n", event.path.c_str());
+            event.prefetchState = FMODPrefetch_Loaded;
+        }
+        PushFMODNotification(FMODNotification_EventPrefetched, event.path, error);
+    }
+}
@@ -0,0 +1,106 @@
+#include "extension.h"
+
+#include <math.h>
+
+/**
+ * Helper function to shape the progress of a ramp
+ * @param curve The shape of the ramp
+ * @param progress How far the ramp is, from 0.0 to 1.0
+ * @return How far the value is from the start to the target, from 0.0 to 1.0
+ */
+float EvaluateFMODRampCurve(FMODRampCurve curve, float progress) {
+    switch (curve) {
+        case FMODRamp_Exponential:
+            // 2^(10t), brought back to start at 0 and end at 1
+            return (powf(2.0f, 10.0f * progress) - 1.0f) / 1023.0f;
+        case FMODRamp_SCurve:
+            return progress * progress * (3.0f - 2.0f * progress);
+        default:
+            return progress;
+    }
+}
+
+/**
+ * Start moving a global parameter towards a value, from its current value
+ * A ramp already running on the parameter is replaced, a plain set of the parameter cancels it
+ * @param parameterHandle The handle of the FMOD Parameter, from GetFMODParameterHandle
+ * @param targetValue The value to reach
+ * @param duration The time to reach it, in seconds (0 to set it on the next update)
+ * @param curve The shape of the ramp
+ */
+void AdaptiveMusicExt::StartFMODParameterRamp(int parameterHandle, float targetValue, float duration, FMODRampCurve curve) {
+    FMODParameterEntry &parameter = fmodParameters[parameterHandle];
+    if (!parameter.resolved && !ResolveFMODParameter(parameter)) {
+        LogFMODMessage("AMM Extension - Could not ramp Global Parameter (%s), it doesn't exist in the loaded banks\n", parameter.name.c_str());
+        return;
+    }
+    float startValue = parameter.value;
+    if (!parameter.valueApplied && fmodStudioSystem->getParameterByID(parameter.id, &startValue) != FMOD_OK) {
+        startValue = targetValue;
+    }
+    CancelFMODParameterRamp(parameterHandle);
+    if (activeFMODParameterRamps.empty()) {
+        // Ramps are only advanced while there are some, the time since the last one doesn't count
+        lastFMODParameterRampUpdate = std::chrono::steady_clock::now();
+    }
+    FMODParameterRamp ramp;
+    ramp.parameterHandle = parameterHandle;
+    ramp.curve = curve;
+    ramp.startValue = startValue;
+    ramp.targetValue = targetValue;
+    ramp.duration = duration > 0.0f ? duration : 0.0f;
+    ramp.elapsed = 0.0f;
+    activeFMODParameterRamps.push_back(ramp);
+}
+
+/**
+ * Stop the ramp of a global parameter where it got to, if it has one
+ * @param parameterHandle The handle of the FMOD Parameter, from GetFMODParameterHandle
+ */
+void AdaptiveMusicExt::CancelFMODParameterRamp(int parameterHandle) {
+    for (size_t i = 0; i < activeFMODParameterRamps.size(); i++) {
+        if (activeFMODParameterRamps[i].parameterHandle == parameterHandle) {
+            activeFMODParameterRamps[i] = activeFMODParameterRamps.back();
+            activeFMODParameterRamps.pop_back();
+            return;
+        }
+    }
+}
+
+/**
+ * Advance the ramps of the global parameters, from the audio thread right before the FMOD update
+ * All the ramped values go to FMOD in a single call
+ */
+void AdaptiveMusicExt::UpdateFMODParameterRamps() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float frameTime = std::chrono::duration<float>(now - lastFMODParameterRampUpdate).count();
+    lastFMODParameterRampUpdate = now;
+    batchedFMODParameterHandles.clear();
+    batchedFMODParameterValues.clear();
+    for (size_t i = 0; i < activeFMODParameterRamps.size();) {
+        FMODParameterRamp &ramp = activeFMODParameterRamps[i];
+        if (!fmodParameters[ramp.parameterHandle].resolved) {
+            // Its bank got unloaded, there's nothing left to ramp
+            activeFMODParameterRamps[i] = activeFMODParameterRamps.back();
+            activeFMODParameterRamps.pop_back();
+            continue;
+        }
+        ramp.elapsed += frameTime;
+        bool finished = ramp.elapsed >= ramp.duration;
+        float value = ramp.targetValue;
+        if (!finished) {
+            value = ramp.startValue + (ramp.targetValue - ramp.startValue) * EvaluateFMODRampCurve(ramp.curve, ramp.elapsed / ramp.duration);
+        }
+        batchedFMODParameterHandles.push_back(ramp.parameterHandle);
+        batchedFMODParameterValues.push_back(value);
+        if (finished) {
+            activeFMODParameterRamps[i] = activeFMODParameterRamps.back();
+            activeFMODParameterRamps.pop_back();
+        } else {
+            i++;
+        }
+    }
+    if (!batchedFMODParameterHandles.empty()) {
+        SetFMODGlobalParametersByHandle(batchedFMODParameterHandles.data(), batchedFMODParameterValues.data(), (int) batchedFMODParameterHandles.size());
+    }
+}
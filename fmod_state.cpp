@@ -1,157 +1,645 @@
 #include "extension.h"
 
 #include <filesystem.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 using namespace SourceHook;
 
 /**
- * Save the current state of bank, event and global parameters to a .musicstate.sav file with the same name as the .sav file
+ * Fill a music state from the current bank, event and global parameters, as last published by the audio thread
+ * @param musicState The music state to fill
  */
-void SaveMusicState(const std::string& musicStateSaveName) {
-    // IF WE'RE DOING AN AUTOSAVE: There is some more stuff to do beforehand
-    if (musicStateSaveName == "autosave.musicstate.sav") {
-        // Shift all the possible autosaveXX.musicstate.sav files
-        for (int i = 98; i >= 1; i--) {
-            // Prepare the "XX" numbers on two digits
-            std::string autosaveIndex = (i < 10) ? "0" + std::to_string(i) : std::to_string(i);
-            std::string autosaveIndexPlusOne = (i + 1 < 10) ? "0" + std::to_string(i + 1) : std::to_string(i + 1);
-
-            // Build the path to the file
-            std::string saveFullPath = "save/autosave" + autosaveIndex + ".musicstate.sav";
-            std::string saveFullPathPlusOne = "save/autosave" + autosaveIndexPlusOne + ".musicstate.sav";
-
-            if (g_AdaptiveMusicExt.filesystem->FileExists(saveFullPath.c_str(), "MOD")) {
-                g_AdaptiveMusicExt.filesystem->RenameFile(saveFullPath.c_str(), saveFullPathPlusOne.c_str(), "MOD");
-            }
-        }
-        if (g_AdaptiveMusicExt.filesystem->FileExists("save/autosave.musicstate.sav", "MOD")) {
-            g_AdaptiveMusicExt.filesystem->RenameFile("save/autosave.musicstate.sav", "save/autosave01.musicstate.sav", "MOD");
+void CaptureMusicState(MusicState &musicState) {
+    FMODStateSnapshot snapshot = g_AdaptiveMusicExt.GetFMODStateSnapshot();
+    std::lock_guard<std::mutex> registryLock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    // BANK
+    musicState.bankName = g_AdaptiveMusicExt.publishedLoadedFMODBankName;
+    // EVENT
+    musicState.eventPath = snapshot.startedEventHandle != -1 ? g_AdaptiveMusicExt.fmodEventRegistry[snapshot.startedEventHandle].path : "";
+    // TIMESTAMP
+    musicState.timelinePosition = snapshot.timelinePosition;
+    // PARAMETERS
+    musicState.parameters.clear();
+    for (const FMODParameterRegistration &parameter : g_AdaptiveMusicExt.fmodParameterRegistry) {
+        if (parameter.resolved) {
+            musicState.parameters.push_back({parameter.name, parameter.value});
         }
     }
+}
 
-    // Build the path to the file
-    std::string saveFullPath = "save/" + musicStateSaveName;
-
-    // When opening the file and writing to it, it gets completely wiped first, so no need to wipe it beforehand
-    FileHandle_t saveFileHandle = g_AdaptiveMusicExt.filesystem->Open(saveFullPath.c_str(), "w", "MOD");
-    if (saveFileHandle == nullptr) {
-        META_CONPRINTF("AMM Extension - Failed to open save file for writing: %s", saveFullPath.c_str());
-        return;
+/**
+ * Apply a saved music state: load its bank, and set its timeline position and global parameters
+ * The event isn't started from the music state, the map's logic does it
+ * @param musicState The music state to apply
+ */
+void ApplyMusicState(const MusicState &musicState) {
+    // Everything goes through the audio thread like the natives' operations, after the ones still queued
+    // The bank is loaded in blocking mode there, so the restored parameters find it loaded
+    // and the restored values win over the queued sets and cancel the ramps in progress
+    std::lock_guard<std::mutex> registryLock(g_AdaptiveMusicExt.fmodRegistryMutex);
+    if (!musicState.bankName.empty()) {
+        int bankHandle = g_AdaptiveMusicExt.GetFMODBankHandle(musicState.bankName);
+        g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_LoadBank, bankHandle, 0.0f);
     }
-    META_CONPRINTF("AMM Extension - Saving the Adaptive Music state to %s\n", saveFullPath.c_str());
+    if (musicState.timelinePosition != -1) {
+        g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetTimelinePosition, musicState.timelinePosition);
+    }
+    for (const MusicStateParameter &parameter : musicState.parameters) {
+        int parameterHandle = g_AdaptiveMusicExt.GetFMODParameterHandle(parameter.name);
+        g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetGlobalParameter, parameterHandle, parameter.value);
+    }
+    if (!musicState.parameters.empty()) {
+        META_CONPRINTF("AMM Extension - %d Global Parameters restored\n", (int) musicState.parameters.size());
+    }
+}
 
-    // Write the current state
-    // BANK
-    g_AdaptiveMusicExt.filesystem->Write("bank ", strlen("bank "), saveFileHandle);
-    std::string bankName = g_AdaptiveMusicExt.loadedFMODStudioBankName;
-    g_AdaptiveMusicExt.filesystem->Write(bankName.c_str(), bankName.length(), saveFileHandle);
-    g_AdaptiveMusicExt.filesystem->Write("\n", 1, saveFileHandle);
+/**
+ * Helper function to append raw bytes to an encoded music state
+ */
+void AppendMusicStateBytes(std::vector<char> &buffer, const void *data, size_t length) {
+    const char *bytes = (const char *) data;
+    buffer.insert(buffer.end(), bytes, bytes + length);
+}
 
-    // EVENT
-    g_AdaptiveMusicExt.filesystem->Write("event ", strlen("event "), saveFileHandle);
-    std::string eventPath = g_AdaptiveMusicExt.startedFMODStudioEventPath;
-    g_AdaptiveMusicExt.filesystem->Write(eventPath.c_str(), eventPath.length(), saveFileHandle);
-    g_AdaptiveMusicExt.filesystem->Write("\n", 1, saveFileHandle);
+/**
+ * Helper function to append a length-prefixed string to an encoded music state
+ */
+void AppendMusicStateString(std::vector<char> &buffer, const std::string &value) {
+    uint16_t length = (uint16_t) (value.length() < 0xFFFF ? value.length() : 0xFFFF);
+    AppendMusicStateBytes(buffer, &length, sizeof(length));
+    AppendMusicStateBytes(buffer, value.data(), length);
+}
 
-    // TIMESTAMP
-    int timelinePosition = g_AdaptiveMusicExt.GetCurrentFMODTimelinePosition();
-    if (timelinePosition != -1) {
-        std::string timelinePositionString = std::to_string(timelinePosition);
-        g_AdaptiveMusicExt.filesystem->Write("timestamp ", strlen("timestamp "), saveFileHandle);
-        g_AdaptiveMusicExt.filesystem->Write(timelinePositionString.c_str(), timelinePositionString.length(), saveFileHandle);
-        g_AdaptiveMusicExt.filesystem->Write("\n", 1, saveFileHandle);
+/**
+ * Encode a music state in the binary .musicstate.sav format
+ * Layout: magic, version, bank, event, timeline position, parameter count, then each parameter's name and value
+ * Strings are prefixed with their 16 bits length, values are stored as-is so floats keep their full precision
+ * @param musicState The music state to encode
+ * @param buffer The buffer to encode into, cleared first
+ */
+void EncodeMusicState(const MusicState &musicState, std::vector<char> &buffer) {
+    buffer.clear();
+    AppendMusicStateBytes(buffer, &MUSIC_STATE_MAGIC, sizeof(MUSIC_STATE_MAGIC));
+    AppendMusicStateBytes(buffer, &MUSIC_STATE_VERSION, sizeof(MUSIC_STATE_VERSION));
+    AppendMusicStateString(buffer, musicState.bankName);
+    AppendMusicStateString(buffer, musicState.eventPath);
+    int32_t timelinePosition = musicState.timelinePosition;
+    AppendMusicStateBytes(buffer, &timelinePosition, sizeof(timelinePosition));
+    uint32_t parameterCount = (uint32_t) musicState.parameters.size();
+    AppendMusicStateBytes(buffer, &parameterCount, sizeof(parameterCount));
+    for (const MusicStateParameter &parameter : musicState.parameters) {
+        AppendMusicStateString(buffer, parameter.name);
+        AppendMusicStateBytes(buffer, &parameter.value, sizeof(parameter.value));
     }
+}
 
-    // PARAMETERS
-    FMOD_STUDIO_PARAMETER_DESCRIPTION globalParameters[128];
-    int parameterCount;
-    FMOD_RESULT result; 
-    result = g_AdaptiveMusicExt.fmodStudioSystem->getParameterDescriptionList(globalParameters, sizeof(globalParameters), &parameterCount);
-    if (result != FMOD_OK) {
-        META_CONPRINTF("AMM Extension - Could not get the Global Parameter count. Error: (%d) %s\n", result, FMOD_ErrorString(result));
-    } else {
-        for (int i = 0; i < parameterCount; i++) {
-            // Get the parameter value
-            float parameterValue;
-            FMOD_RESULT result; 
-            result = g_AdaptiveMusicExt.fmodStudioSystem->getParameterByName(globalParameters[i].name, &parameterValue);
-            if (result != FMOD_OK) {
-                META_CONPRINTF("AMM Extension - Could not get the Global Parameter value. Error: (%d) %s\n", result, FMOD_ErrorString(result));
-            } else {
-                // parameter (space)
-                g_AdaptiveMusicExt.filesystem->Write("parameter ", strlen("parameter "), saveFileHandle);
-                // parameter_name
-                std::string parameterName = globalParameters[i].name;
-                g_AdaptiveMusicExt.filesystem->Write(parameterName.c_str(), parameterName.length(), saveFileHandle);
-                // (space)
-                g_AdaptiveMusicExt.filesystem->Write(" ", strlen(" "), saveFileHandle);
-                // parameter_value
-                std::string parameterValueString = std::to_string(parameterValue);
-                g_AdaptiveMusicExt.filesystem->Write(parameterValueString.c_str(), parameterValueString.length(), saveFileHandle);
-                g_AdaptiveMusicExt.filesystem->Write("\n", 1, saveFileHandle);
-            }
-        }
+/**
+ * Helper function to read raw bytes from an encoded music state
+ * @return false if the buffer is too short
+ */
+bool ReadMusicStateBytes(const std::vector<char> &buffer, size_t &offset, void *data, size_t length) {
+    if (buffer.size() - offset < length) {
+        return false;
     }
+    memcpy(data, buffer.data() + offset, length);
+    offset += length;
+    return true;
+}
 
-    // Close the handle
-    g_AdaptiveMusicExt.filesystem->Close(saveFileHandle);
+/**
+ * Helper function to read a length-prefixed string from an encoded music state
+ * @return false if the buffer is too short
+ */
+bool ReadMusicStateString(const std::vector<char> &buffer, size_t &offset, std::string &value) {
+    uint16_t length;
+    if (!ReadMusicStateBytes(buffer, offset, &length, sizeof(length)) || buffer.size() - offset < length) {
+        return false;
+    }
+    value.assign(buffer.data() + offset, length);
+    offset += length;
+    return true;
 }
 
 /**
- * Restore the current state of bank, event and global parameters from a .kv file with the same name as the .sav file
+ * Decode a music state from the binary .musicstate.sav format
+ * @param buffer The contents of the file
+ * @param musicState The music state to fill
+ * @return false if the file is truncated or from an unknown version
  */
-void RestoreMusicState(const std::string& musicStateSaveName) {
-    // Build the path to the file
-    std::string saveFullPath = "save/" + musicStateSaveName;
-    
-    FileHandle_t saveFileHandle = g_AdaptiveMusicExt.filesystem->Open(saveFullPath.c_str(), "r", "MOD");
-    if (saveFileHandle == nullptr) {
-        META_CONPRINTF("AMM Extension - Failed to open save file for reading: %s\n", saveFullPath.c_str());
-        return;
+bool DecodeMusicState(const std::vector<char> &buffer, MusicState &musicState) {
+    size_t offset = 0;
+    uint32_t magic;
+    uint32_t version;
+    if (!ReadMusicStateBytes(buffer, offset, &magic, sizeof(magic)) || magic != MUSIC_STATE_MAGIC ||
+        !ReadMusicStateBytes(buffer, offset, &version, sizeof(version)) || version != MUSIC_STATE_VERSION) {
+        return false;
+    }
+    int32_t timelinePosition;
+    uint32_t parameterCount;
+    if (!ReadMusicStateString(buffer, offset, musicState.bankName) ||
+        !ReadMusicStateString(buffer, offset, musicState.eventPath) ||
+        !ReadMusicStateBytes(buffer, offset, &timelinePosition, sizeof(timelinePosition)) ||
+        !ReadMusicStateBytes(buffer, offset, &parameterCount, sizeof(parameterCount))) {
+        return false;
+    }
+    musicState.timelinePosition = timelinePosition;
+    musicState.parameters.clear();
+    for (uint32_t i = 0; i < parameterCount; i++) {
+        MusicStateParameter parameter;
+        if (!ReadMusicStateString(buffer, offset, parameter.name) ||
+            !ReadMusicStateBytes(buffer, offset, &parameter.value, sizeof(parameter.value))) {
+            return false;
+        }
+        musicState.parameters.push_back(parameter);
     }
-    META_CONPRINTF("AMM Extension - Restoring the Adaptive Music state from %s\n", saveFullPath.c_str());
+    return true;
+}
+
+/**
+ * Decode a music state from the text format written by the previous versions, one "keyword value(s)" line per entry
+ * @param buffer The contents of the file
+ * @param musicState The music state to fill
+ * @return Always true, unknown or broken lines are skipped
+ */
+bool DecodeTextMusicState(const std::vector<char> &buffer, MusicState &musicState) {
+    musicState.bankName.clear();
+    musicState.eventPath.clear();
+    musicState.timelinePosition = -1;
+    musicState.parameters.clear();
+    std::string text(buffer.begin(), buffer.end());
+    size_t lineStart = 0;
+    while (lineStart < text.length()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = text.length();
+        }
+        std::string line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
 
-    // Read the current state
-    char buf[512];
-    g_AdaptiveMusicExt.filesystem->ReadLine(buf, sizeof(buf), saveFileHandle);
-    while (std::strcmp(buf, "") != 0) {
         // READ THE LINE AND FILL THE TOKENS
         std::vector<std::string> tokens;
-        char* token = std::strtok(buf, " ");
+        char* token = std::strtok(&line[0], " \r");
         while (token != nullptr) {
-            std::string tokenStr = token;
-            // Remove newline characters
-            tokenStr.erase(std::remove(tokenStr.begin(), tokenStr.end(), '\n'), tokenStr.end());
-            tokens.push_back(tokenStr);
-            token = std::strtok(nullptr, " ");
+            tokens.push_back(token);
+            token = std::strtok(nullptr, " \r");
         }
 
         // BANK
         if (tokens.size() > 1 && tokens[0] == "bank") {
-            g_AdaptiveMusicExt.LoadFMODBank(tokens[1].c_str());
+            musicState.bankName = tokens[1];
         }
 
         // EVENT
         if (tokens.size() > 1 && tokens[0] == "event") {
-            // g_AdaptiveMusicExt.StartFMODEvent(tokens[1].c_str()); 
-            // Don't start the event from the save file, the KeyValues parsing will
+            musicState.eventPath = tokens[1];
         }
 
         // TIMESTAMP
         if (tokens.size() > 1 && tokens[0] == "timestamp") {
-            g_AdaptiveMusicExt.SetCurrentFMODTimelinePosition(std::stoi(tokens[1]));
+            musicState.timelinePosition = atoi(tokens[1].c_str());
         }
 
         // PARAMETERS
         if (tokens.size() > 2 && tokens[0] == "parameter") {
-            g_AdaptiveMusicExt.SetFMODGlobalParameter(tokens[1].c_str(), std::stof(tokens[2]));
+            musicState.parameters.push_back({tokens[1], (float) atof(tokens[2].c_str())});
         }
+    }
+    return true;
+}
+
+/**
+ * Helper function to get the name of a physical autosave slot file
+ */
+std::string GetMusicStateAutosaveSlotName(int slot) {
+    char slotName[64];
+    snprintf(slotName, sizeof(slotName), "autosave.slot%02d.musicstate.sav", slot);
+    return slotName;
+}
+
+/**
+ * Load the autosave manifest, once, telling which slot file holds the most recent autosave
+ * Without a manifest no autosave was made with the slots yet, the autosaveXX files are then used as they are
+ */
+void LoadMusicStateAutosaveManifest() {
+    if (g_AdaptiveMusicExt.musicStateAutosaveManifestLoaded) {
+        return;
+    }
+    g_AdaptiveMusicExt.musicStateAutosaveManifestLoaded = true;
+    // No autosave is queued before the manifest is loaded, the writer thread doesn't use the slots yet
+    g_AdaptiveMusicExt.musicStateAutosaveHead = 0;
+    g_AdaptiveMusicExt.musicStateAutosaveCount = 0;
+    std::string manifestFullPath = "save/" MUSIC_STATE_AUTOSAVE_MANIFEST;
+    FileHandle_t manifestFileHandle = g_AdaptiveMusicExt.filesystem->Open(manifestFullPath.c_str(), "rb", "MOD");
+    if (manifestFileHandle == nullptr) {
+        return;
+    }
+    uint32_t manifest[4];
+    int read = g_AdaptiveMusicExt.filesystem->Read(manifest, sizeof(manifest), manifestFileHandle);
+    g_AdaptiveMusicExt.filesystem->Close(manifestFileHandle);
+    if (read != sizeof(manifest) || manifest[0] != MUSIC_STATE_AUTOSAVE_MANIFEST_MAGIC || manifest[1] != MUSIC_STATE_VERSION ||
+        manifest[2] >= MUSIC_STATE_AUTOSAVE_SLOTS || manifest[3] > MUSIC_STATE_AUTOSAVE_SLOTS) {
+        META_CONPRINTF("AMM Extension - Ignoring the invalid autosave manifest %s\n", manifestFullPath.c_str());
+        return;
+    }
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+    g_AdaptiveMusicExt.musicStateAutosaveHead = manifest[2];
+    g_AdaptiveMusicExt.musicStateAutosaveCount = manifest[3];
+}
 
-        g_AdaptiveMusicExt.filesystem->ReadLine(buf, sizeof(buf), saveFileHandle);
+/**
+ * Pick the slot following the most recent autosave, the oldest autosave gets overwritten once they're all used
+ * The slot is only taken once the autosave is written, with CommitMusicStateAutosaveSlot
+ * Must be called with the music state writer mutex held
+ * @param slot Filled with the slot to write the autosave to
+ * @param count Filled with the number of slots holding an autosave once it's written
+ */
+void GetNextMusicStateAutosaveSlot(int &slot, int &count) {
+    slot = g_AdaptiveMusicExt.musicStateAutosaveHead;
+    count = g_AdaptiveMusicExt.musicStateAutosaveCount;
+    if (count > 0) {
+        slot = (slot + 1) % MUSIC_STATE_AUTOSAVE_SLOTS;
     }
+    if (count < MUSIC_STATE_AUTOSAVE_SLOTS) {
+        count++;
+    }
+}
 
-    // Close the handle
+/**
+ * Helper function to tell how many autosaves were made after the one of an autosave name
+ * @param musicStateSaveName The name of the .musicstate.sav file, from the engine's .sav name
+ * @return XX for autosaveXX.musicstate.sav, 0 for autosave.musicstate.sav, -1 for the other saves
+ */
+int GetMusicStateAutosaveAge(const std::string &musicStateSaveName) {
+    const std::string prefix = "autosave";
+    const std::string suffix = ".musicstate.sav";
+    if (musicStateSaveName.length() < prefix.length() + suffix.length() ||
+        musicStateSaveName.compare(0, prefix.length(), prefix) != 0 ||
+        musicStateSaveName.compare(musicStateSaveName.length() - suffix.length(), suffix.length(), suffix) != 0) {
+        return -1;
+    }
+    std::string autosaveIndex = musicStateSaveName.substr(prefix.length(), musicStateSaveName.length() - prefix.length() - suffix.length());
+    if (autosaveIndex.empty()) {
+        return 0;
+    }
+    // Only autosaveXX, the engine's other autosaves (autosavedangerous...) are regular saves
+    if (autosaveIndex.length() != 2 || !isdigit(autosaveIndex[0]) || !isdigit(autosaveIndex[1])) {
+        return -1;
+    }
+    return atoi(autosaveIndex.c_str());
+}
+
+/**
+ * Resolve the engine's autosave.musicstate.sav and autosaveXX.musicstate.sav names to the slot files holding them
+ * autosaveXX is the autosave made XX autosaves before the latest one written to disk
+ * @param musicStateSaveName The name of the .musicstate.sav file, from the engine's .sav name
+ * @return The name of the file to read, unchanged for the other saves
+ */
+std::string ResolveMusicStateSaveName(const std::string &musicStateSaveName) {
+    int age = GetMusicStateAutosaveAge(musicStateSaveName);
+    if (age == -1) {
+        return musicStateSaveName;
+    }
+    LoadMusicStateAutosaveManifest();
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+    if (age >= g_AdaptiveMusicExt.musicStateAutosaveCount) {
+        // Made before the slots existed, the legacy files are named after their age among the autosaves older than the slots
+        int legacyAge = age - g_AdaptiveMusicExt.musicStateAutosaveCount;
+        if (legacyAge == 0) {
+            return "autosave.musicstate.sav";
+        }
+        char legacySaveName[64];
+        snprintf(legacySaveName, sizeof(legacySaveName), "autosave%02d.musicstate.sav", legacyAge);
+        return legacySaveName;
+    }
+    int slot = (g_AdaptiveMusicExt.musicStateAutosaveHead - age + MUSIC_STATE_AUTOSAVE_SLOTS) % MUSIC_STATE_AUTOSAVE_SLOTS;
+    return GetMusicStateAutosaveSlotName(slot);
+}
+
+/**
+ * Replace a file by another one in a single step, so the destination is never seen half-written
+ * @param fromPath The full path of the file to move
+ * @param toPath The full path of the file to replace
+ * @return true if the file was replaced
+ */
+bool AtomicReplaceFile(const std::string &fromPath, const std::string &toPath) {
+#ifdef _WIN32
+    return MoveFileExA(fromPath.c_str(), toPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(fromPath.c_str(), toPath.c_str()) == 0;
+#endif
+}
+
+/**
+ * Write a file of the save folder to a temporary file, then move it over the actual one
+ * Runs on the music state writer thread, which can't print to the console
+ * @param saveName The name of the file in the save folder
+ * @param buffer The contents of the file
+ * @param message Filled with what went wrong if the file couldn't be written
+ * @return true if the file was written
+ */
+bool WriteMusicStateFile(const std::string &saveName, const std::vector<char> &buffer, std::string &message) {
+    std::string baseDir = g_SMAPI->GetBaseDir();
+    std::string saveFullPath = baseDir + "/save/" + saveName;
+    std::replace(saveFullPath.begin(), saveFullPath.end(), '\\', '/');
+    std::string temporaryFullPath = saveFullPath + ".tmp";
+
+    FileHandle_t saveFileHandle = g_AdaptiveMusicExt.filesystem->Open(temporaryFullPath.c_str(), "wb");
+    if (saveFileHandle == nullptr) {
+        message = "Failed to open save file for writing: " + temporaryFullPath;
+        return false;
+    }
+    int written = g_AdaptiveMusicExt.filesystem->Write(buffer.data(), (int) buffer.size(), saveFileHandle);
     g_AdaptiveMusicExt.filesystem->Close(saveFileHandle);
+    if (written != (int) buffer.size()) {
+        message = "Could not write the whole save file: " + temporaryFullPath;
+        g_AdaptiveMusicExt.filesystem->RemoveFile(temporaryFullPath.c_str());
+        return false;
+    }
+    if (!AtomicReplaceFile(temporaryFullPath, saveFullPath)) {
+        message = "Could not replace the save file: " + saveFullPath;
+        g_AdaptiveMusicExt.filesystem->RemoveFile(temporaryFullPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Make a written autosave slot the most recent autosave, in memory and in the manifest
+ * Runs on the music state writer thread, right after the slot file is written
+ * @param slot The slot the autosave was written to
+ * @param count The number of slots holding an autosave, from GetNextMusicStateAutosaveSlot
+ * @param message Filled with what went wrong if the manifest couldn't be written
+ * @return true if the manifest was written
+ */
+bool CommitMusicStateAutosaveSlot(int slot, int count, std::string &message) {
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+        g_AdaptiveMusicExt.musicStateAutosaveHead = slot;
+        g_AdaptiveMusicExt.musicStateAutosaveCount = count;
+    }
+    uint32_t manifest[4] = {MUSIC_STATE_AUTOSAVE_MANIFEST_MAGIC, MUSIC_STATE_VERSION, (uint32_t) slot, (uint32_t) count};
+    std::vector<char> manifestBuffer((const char *) manifest, (const char *) manifest + sizeof(manifest));
+    return WriteMusicStateFile(MUSIC_STATE_AUTOSAVE_MANIFEST, manifestBuffer, message);
+}
+
+/**
+ * Keep an encoded music state in the cache, replacing the least recently used one when it's full
+ * Must be called with the music state writer mutex held
+ * @param saveName The name of the .musicstate.sav file
+ * @param fileTime The modification time of the file holding this state, 0 while it's not written yet
+ * @param writeSequence The sequence of the write putting this state on disk, 0 if read from disk
+ * @param buffer The encoded music state
+ */
+void CacheMusicState(const std::string &saveName, long fileTime, unsigned int writeSequence, const std::vector<char> &buffer) {
+    std::vector<MusicStateCacheEntry> &musicStateCache = g_AdaptiveMusicExt.musicStateCache;
+    size_t cacheIndex = musicStateCache.size();
+    for (size_t i = 0; i < musicStateCache.size(); i++) {
+        if (musicStateCache[i].saveName == saveName) {
+            cacheIndex = i;
+            break;
+        }
+    }
+    if (cacheIndex == musicStateCache.size()) {
+        if (musicStateCache.size() < MUSIC_STATE_CACHE_SIZE) {
+            musicStateCache.push_back(MusicStateCacheEntry());
+        } else {
+            cacheIndex = 0;
+            for (size_t i = 1; i < musicStateCache.size(); i++) {
+                if (musicStateCache[i].lastUse < musicStateCache[cacheIndex].lastUse) {
+                    cacheIndex = i;
+                }
+            }
+        }
+    }
+    MusicStateCacheEntry &cacheEntry = musicStateCache[cacheIndex];
+    cacheEntry.saveName = saveName;
+    cacheEntry.fileTime = fileTime;
+    cacheEntry.writeSequence = writeSequence;
+    cacheEntry.buffer = buffer;
+    cacheEntry.lastUse = ++g_AdaptiveMusicExt.musicStateCacheUseCounter;
+}
+
+/**
+ * Look for an encoded music state in the cache
+ * Must be called with the music state writer mutex held
+ * @param saveName The name of the .musicstate.sav file
+ * @param fileTime The current modification time of the file, a cached state is only used if it's the one the file holds
+ * @param buffer Filled with the encoded music state if it's cached
+ * @return true if the state was cached
+ */
+bool FindCachedMusicState(const std::string &saveName, long fileTime, std::vector<char> &buffer) {
+    for (MusicStateCacheEntry &cacheEntry : g_AdaptiveMusicExt.musicStateCache) {
+        if (cacheEntry.saveName == saveName && cacheEntry.fileTime != 0 && cacheEntry.fileTime == fileTime) {
+            cacheEntry.lastUse = ++g_AdaptiveMusicExt.musicStateCacheUseCounter;
+            buffer = cacheEntry.buffer;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Body of the music state writer thread, writes the queued music states in order until it's stopped
+ */
+void RunMusicStateWriter() {
+    std::unique_lock<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+    while (true) {
+        g_AdaptiveMusicExt.musicStateWriteAdded.wait(lock, [] {
+            return !g_AdaptiveMusicExt.pendingMusicStateWrites.empty() || !g_AdaptiveMusicExt.musicStateWriterRunning;
+        });
+        // Writes still queued when stopping are done first, so no save gets lost
+        if (g_AdaptiveMusicExt.pendingMusicStateWrites.empty()) {
+            break;
+        }
+        // Stays at the front of the queue while being written, so restores wait for it
+        const MusicStateWrite &musicStateWrite = g_AdaptiveMusicExt.pendingMusicStateWrites.front();
+        std::string saveName = musicStateWrite.saveName;
+        int autosaveSlot = 0;
+        int autosaveCount = 0;
+        if (musicStateWrite.autosave) {
+            GetNextMusicStateAutosaveSlot(autosaveSlot, autosaveCount);
+            saveName = GetMusicStateAutosaveSlotName(autosaveSlot);
+        }
+        lock.unlock();
+        std::string message;
+        bool written = WriteMusicStateFile(saveName, musicStateWrite.buffer, message);
+        long fileTime = 0;
+        if (written) {
+            std::string saveFullPath = "save/" + saveName;
+            fileTime = g_AdaptiveMusicExt.filesystem->GetFileTime(saveFullPath.c_str(), "MOD");
+            message = "Adaptive Music state written to " + saveFullPath;
+        }
+        // The slot only becomes the latest autosave once it's on disk, a failed write leaves the previous one
+        if (written && musicStateWrite.autosave) {
+            std::string manifestMessage;
+            if (!CommitMusicStateAutosaveSlot(autosaveSlot, autosaveCount, manifestMessage)) {
+                message += ", but not its autosave manifest. " + manifestMessage;
+            }
+        }
+        lock.lock();
+        g_AdaptiveMusicExt.musicStateWriteMessages.push_back(message);
+        if (written && musicStateWrite.autosave) {
+            // Its slot wasn't known when it was saved
+            CacheMusicState(saveName, fileTime, musicStateWrite.sequence, musicStateWrite.buffer);
+        }
+        // The cached state now matches the file, unless it was saved again in the meantime
+        for (MusicStateCacheEntry &cacheEntry : g_AdaptiveMusicExt.musicStateCache) {
+            if (cacheEntry.saveName == saveName && cacheEntry.writeSequence == musicStateWrite.sequence) {
+                cacheEntry.fileTime = fileTime;
+            }
+        }
+        g_AdaptiveMusicExt.pendingMusicStateWrites.pop_front();
+        g_AdaptiveMusicExt.musicStateWriteDone.notify_all();
+    }
+}
+
+/**
+ * Print how the background writes went, from the game frame
+ */
+void PrintMusicStateWriteMessages() {
+    std::vector<std::string> messages;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+        if (g_AdaptiveMusicExt.musicStateWriteMessages.empty()) {
+            return;
+        }
+        messages.swap(g_AdaptiveMusicExt.musicStateWriteMessages);
+    }
+    for (const std::string &message : messages) {
+        META_CONPRINTF("AMM Extension - %s\n", message.c_str());
+    }
+}
+
+/**
+ * Start the thread writing the music states in the background
+ */
+void StartMusicStateWriter() {
+    g_AdaptiveMusicExt.musicStateWriterRunning = true;
+    g_AdaptiveMusicExt.musicStateWriterThread = std::thread(RunMusicStateWriter);
+}
+
+/**
+ * Stop the music state writer thread, once all the queued music states are written
+ */
+void StopMusicStateWriter() {
+    if (!g_AdaptiveMusicExt.musicStateWriterThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+        g_AdaptiveMusicExt.musicStateWriterRunning = false;
+    }
+    g_AdaptiveMusicExt.musicStateWriteAdded.notify_all();
+    g_AdaptiveMusicExt.musicStateWriterThread.join();
+}
+
+/**
+ * Wait for the queued writes of a save slot to be on disk
+ * @param musicStateSaveName The name of the .musicstate.sav file
+ */
+void WaitForMusicStateWrites(const std::string &musicStateSaveName) {
+    std::unique_lock<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+    g_AdaptiveMusicExt.musicStateWriteDone.wait(lock, [&musicStateSaveName] {
+        for (const MusicStateWrite &musicStateWrite : g_AdaptiveMusicExt.pendingMusicStateWrites) {
+            if (musicStateWrite.saveName == musicStateSaveName) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+/**
+ * Save the current state of bank, event and global parameters to a .musicstate.sav file with the same name as the .sav file
+ * The state is captured right away, the file itself is written in the background
+ */
+void SaveMusicState(const std::string& musicStateSaveName) {
+    AMM_TIME_SCOPE("Music state save");
+    // The whole state is encoded beforehand so it only takes a single write
+    MusicStateWrite musicStateWrite;
+    musicStateWrite.saveName = musicStateSaveName;
+    // IF WE'RE DOING AN AUTOSAVE: It goes to the next slot instead of shifting all the older autosaves
+    musicStateWrite.autosave = musicStateSaveName == "autosave.musicstate.sav";
+    if (musicStateWrite.autosave) {
+        LoadMusicStateAutosaveManifest();
+    }
+    MusicState musicState;
+    CaptureMusicState(musicState);
+    EncodeMusicState(musicState, musicStateWrite.buffer);
+
+    META_CONPRINTF("AMM Extension - Saving the Adaptive Music state to save/%s\n", musicStateWrite.saveName.c_str());
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+        musicStateWrite.sequence = ++g_AdaptiveMusicExt.musicStateWriteSequence;
+        if (!musicStateWrite.autosave) {
+            CacheMusicState(musicStateWrite.saveName, 0, musicStateWrite.sequence, musicStateWrite.buffer);
+        }
+        g_AdaptiveMusicExt.pendingMusicStateWrites.push_back(std::move(musicStateWrite));
+    }
+    g_AdaptiveMusicExt.musicStateWriteAdded.notify_one();
+}
+
+/**
+ * Restore the current state of bank, event and global parameters from a .musicstate.sav file with the same name as the .sav file
+ */
+void RestoreMusicState(const std::string& musicStateSaveName) {
+    AMM_TIME_SCOPE("Music state restore");
+    // The autosave slots only move once the queued autosaves are written
+    if (GetMusicStateAutosaveAge(musicStateSaveName) != -1) {
+        WaitForMusicStateWrites("autosave.musicstate.sav");
+    }
+    std::string resolvedSaveName = ResolveMusicStateSaveName(musicStateSaveName);
+
+    // Never read a file that's still being written
+    WaitForMusicStateWrites(resolvedSaveName);
+
+    // Build the path to the file
+    std::string saveFullPath = "save/" + resolvedSaveName;
+
+    // Reloading the same save over and over only needs the file's modification time
+    std::vector<char> musicStateBuffer;
+    long fileTime = g_AdaptiveMusicExt.filesystem->GetFileTime(saveFullPath.c_str(), "MOD");
+    bool cached;
+    {
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+        cached = FindCachedMusicState(resolvedSaveName, fileTime, musicStateBuffer);
+    }
+    if (cached) {
+        g_AdaptiveMusicExt.musicStateCacheHits++;
+        META_CONPRINTF("AMM Extension - Restoring the Adaptive Music state of %s from memory\n", saveFullPath.c_str());
+    } else {
+        g_AdaptiveMusicExt.musicStateCacheMisses++;
+        FileHandle_t saveFileHandle = g_AdaptiveMusicExt.filesystem->Open(saveFullPath.c_str(), "rb", "MOD");
+        if (saveFileHandle == nullptr) {
+            META_CONPRINTF("AMM Extension - Failed to open save file for reading: %s\n", saveFullPath.c_str());
+            return;
+        }
+        META_CONPRINTF("AMM Extension - Restoring the Adaptive Music state from %s\n", saveFullPath.c_str());
+
+        // Read the whole file at once
+        musicStateBuffer.resize(g_AdaptiveMusicExt.filesystem->Size(saveFileHandle));
+        int read = g_AdaptiveMusicExt.filesystem->Read(musicStateBuffer.data(), (int) musicStateBuffer.size(), saveFileHandle);
+        g_AdaptiveMusicExt.filesystem->Close(saveFileHandle);
+        musicStateBuffer.resize(read > 0 ? read : 0);
+        std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+        CacheMusicState(resolvedSaveName, fileTime, 0, musicStateBuffer);
+    }
+
+    // Saves made before the binary format are still in the text one
+    MusicState musicState;
+    bool decoded;
+    if (musicStateBuffer.size() >= sizeof(MUSIC_STATE_MAGIC) && memcmp(musicStateBuffer.data(), &MUSIC_STATE_MAGIC, sizeof(MUSIC_STATE_MAGIC)) == 0) {
+        decoded = DecodeMusicState(musicStateBuffer, musicState);
+    } else {
+        decoded = DecodeTextMusicState(musicStateBuffer, musicState);
+    }
+    if (!decoded) {
+        META_CONPRINTF("AMM Extension - Could not decode the save file: %s\n", saveFullPath.c_str());
+        return;
+    }
+    ApplyMusicState(musicState);
 }
 
 /**
@@ -184,7 +672,11 @@ std::string replaceSavWithMusicState(const std::string& original) {
     return dataStart.substr(0, dataStart.length() - oldSuffix.length()) + newSuffix;
 }
 
-void SyncFMODSettings() {
+/**
+ * Sync the settings from the client config file, for when the settings ConVars aren't available
+ * Reads the file on the game thread, the values go to the audio thread as commands
+ */
+void SyncFMODSettingsFromConfig() {
     // Go through the client config file
     std::string configFilePath = "cfg/config.cfg";
     FileHandle_t configFileHandle = g_AdaptiveMusicExt.filesystem->Open(configFilePath.c_str(), "r", "MOD");
@@ -213,7 +705,7 @@ void SyncFMODSettings() {
             if (tokens[1].size() > 2) {
                 std::string result = tokens[1].substr(1, tokens[1].size() - 2);
                 float volume = std::stof(result);
-                g_AdaptiveMusicExt.SetFMODVolume(volume);
+                g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetVolume, g_AdaptiveMusicExt.masterBusHandle, volume);
             }
         }
         g_AdaptiveMusicExt.filesystem->ReadLine(buf, sizeof(buf), configFileHandle);
@@ -222,6 +714,72 @@ void SyncFMODSettings() {
     g_AdaptiveMusicExt.filesystem->Close(configFileHandle);
 }
 
+/**
+ * Sync the settings, volume etc, from the live ConVars, or from the client config file if they don't exist (dedicated servers)
+ * Called from the game thread, the settings are applied by the next update of the audio thread
+ */
+void SyncFMODSettings() {
+    if (g_AdaptiveMusicExt.musicVolumeConVar != nullptr) {
+        g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetVolume, g_AdaptiveMusicExt.masterBusHandle, g_AdaptiveMusicExt.musicVolumeConVar->GetFloat());
+        return;
+    }
+    SyncFMODSettingsFromConfig();
+}
+
+/**
+ * Global ConVar change callback, follows snd_musicvolume as it's changed
+ */
+void OnFMODSettingChanged(IConVar *var, const char *pOldValue, float flOldValue) {
+    if (g_AdaptiveMusicExt.musicVolumeConVar == nullptr || g_AdaptiveMusicExt.fmodStudioSystem == nullptr ||
+        strcmp(var->GetName(), "snd_musicvolume") != 0) {
+        return;
+    }
+    // Applied by the audio thread, with the other operations of its next update
+    g_AdaptiveMusicExt.QueueFMODCommand(FMODCommand_SetVolume, g_AdaptiveMusicExt.masterBusHandle, g_AdaptiveMusicExt.musicVolumeConVar->GetFloat());
+}
+
+/**
+ * Start following the settings ConVars and sync the current settings
+ */
+void StartFMODSettingsSync() {
+    g_AdaptiveMusicExt.musicVolumeConVar = g_pCVar->FindVar("snd_musicvolume");
+    if (g_AdaptiveMusicExt.musicVolumeConVar != nullptr) {
+        g_pCVar->InstallGlobalChangeCallback(OnFMODSettingChanged);
+    }
+    SyncFMODSettings();
+}
+
+/**
+ * Stop following the settings ConVars
+ */
+void StopFMODSettingsSync() {
+    if (g_AdaptiveMusicExt.musicVolumeConVar != nullptr) {
+        g_pCVar->RemoveGlobalChangeCallback(OnFMODSettingChanged);
+        g_AdaptiveMusicExt.musicVolumeConVar = nullptr;
+    }
+}
+
+/**
+ * Print how often the music states were restored from memory rather than from disk
+ */
+CON_COMMAND(amm_musicstate_cache, "Print the hit/miss counts of the in-memory music state cache (amm_musicstate_cache clear to empty it)") {
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.musicStateWriterMutex);
+    if (args.ArgC() > 1 && strcmp(args.Arg(1), "clear") == 0) {
+        g_AdaptiveMusicExt.musicStateCache.clear();
+        g_AdaptiveMusicExt.musicStateCacheHits = 0;
+        g_AdaptiveMusicExt.musicStateCacheMisses = 0;
+        META_CONPRINTF("AMM Extension - Music state cache cleared\n");
+        return;
+    }
+    META_CONPRINTF("AMM Extension - Music state cache: %u hits, %u misses, %d/%d states cached\n",
+                   g_AdaptiveMusicExt.musicStateCacheHits, g_AdaptiveMusicExt.musicStateCacheMisses,
+                   (int) g_AdaptiveMusicExt.musicStateCache.size(), (int) MUSIC_STATE_CACHE_SIZE);
+    for (const MusicStateCacheEntry &cacheEntry : g_AdaptiveMusicExt.musicStateCache) {
+        META_CONPRINTF("  %s (%d bytes)%s\n", cacheEntry.saveName.c_str(), (int) cacheEntry.buffer.size(),
+                       cacheEntry.fileTime == 0 ? " - not written yet" : "");
+    }
+}
+
 SH_DECL_HOOK1_void(IServerGameDLL, SaveGlobalState, SH_NOATTRIB, 0, CSaveRestoreData *);
 SH_DECL_HOOK1_void(IServerGameDLL, RestoreGlobalState, SH_NOATTRIB, 0, CSaveRestoreData *);
 SH_DECL_HOOK2_void(IServerGameDLL, Restore, SH_NOATTRIB, 0, CSaveRestoreData *, bool);
@@ -252,6 +810,7 @@ void Hook_Restore(CSaveRestoreData *saveRestoreData, bool)
 
 void AddFMODStateHooks()
 {
+   StartMusicStateWriter();
    SH_ADD_HOOK(IServerGameDLL, SaveGlobalState, gamedll, SH_STATIC(Hook_SaveGlobalState), false);
    SH_ADD_HOOK(IServerGameDLL, RestoreGlobalState, gamedll, SH_STATIC(Hook_RestoreGlobalState), false); // THIS DOES NOT TRIGGER ON FIRST LOAD
    SH_ADD_HOOK(IServerGameDLL, Restore, gamedll, SH_STATIC(Hook_Restore), false); // THIS DOES TRIGGER ON FIRST LOAD
@@ -262,4 +821,6 @@ void RemoveFMODStateHooks()
    SH_REMOVE_HOOK(IServerGameDLL, SaveGlobalState, gamedll, SH_STATIC(Hook_SaveGlobalState), false);
    SH_REMOVE_HOOK(IServerGameDLL, RestoreGlobalState, gamedll, SH_STATIC(Hook_RestoreGlobalState), false); // THIS DOES NOT TRIGGER ON FIRST LOAD
    SH_REMOVE_HOOK(IServerGameDLL, Restore, gamedll, SH_STATIC(Hook_Restore), false); // THIS DOES TRIGGER ON FIRST LOAD
+   StopMusicStateWriter();
+   PrintMusicStateWriteMessages();
 }
@@ -0,0 +1,85 @@
+#include "extension.h"
+
+/**
+ * Register a histogram for amm_stats, the histograms live as long as the extension
+ * @param name The name of the native or operation, printed by amm_stats
+ */
+FMODLatencyHistogram::FMODLatencyHistogram(const char *name) : name(name) {
+    Reset();
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.latencyHistogramsMutex);
+    g_AdaptiveMusicExt.latencyHistograms.push_back(this);
+}
+
+/**
+ * Add a duration to the histogram
+ * @param nanoseconds The duration, in nanoseconds
+ */
+void FMODLatencyHistogram::Record(unsigned long long nanoseconds) {
+    int bucket = 0;
+    while (bucket < AMM_LATENCY_BUCKET_COUNT - 1 && (nanoseconds >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    calls.fetch_add(1, std::memory_order_relaxed);
+    totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    unsigned long long currentMax = maxNanoseconds.load(std::memory_order_relaxed);
+    while (nanoseconds > currentMax && !maxNanoseconds.compare_exchange_weak(currentMax, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Clear the histogram, durations recorded meanwhile may be partly kept
+ */
+void FMODLatencyHistogram::Reset() {
+    calls = 0;
+    totalNanoseconds = 0;
+    maxNanoseconds = 0;
+    for (int i = 0; i < AMM_LATENCY_BUCKET_COUNT; i++) {
+        buckets[i] = 0;
+    }
+}
+
+/**
+ * Helper function to estimate a percentile of a histogram, as the upper bound of the bucket it falls in
+ * @return The percentile, in microseconds
+ */
+double GetFMODLatencyPercentile(const FMODLatencyHistogram &histogram, unsigned long long calls, double percentile) {
+    unsigned long long rank = (unsigned long long) (calls * percentile);
+    unsigned long long seen = 0;
+    for (int i = 0; i < AMM_LATENCY_BUCKET_COUNT; i++) {
+        seen += histogram.buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            // The slowest bucket can't go over the slowest call
+            unsigned long long upperBound = 2ULL << i;
+            unsigned long long maxNanoseconds = histogram.maxNanoseconds.load(std::memory_order_relaxed);
+            return (upperBound < maxNanoseconds ? upperBound : maxNanoseconds) / 1000.0;
+        }
+    }
+    return histogram.maxNanoseconds.load(std::memory_order_relaxed) / 1000.0;
+}
+
+/**
+ * Print how long the natives and the main operations of the extension take
+ */
+CON_COMMAND(amm_stats, "Print the call counts and latencies of the natives and operations of the extension (amm_stats reset to clear them)") {
+    std::lock_guard<std::mutex> lock(g_AdaptiveMusicExt.latencyHistogramsMutex);
+    if (args.ArgC() > 1 && strcmp(args.Arg(1), "reset") == 0) {
+        for (FMODLatencyHistogram *histogram : g_AdaptiveMusicExt.latencyHistograms) {
+            histogram->Reset();
+        }
+        META_CONPRINTF("AMM Extension - Latency statistics cleared\n");
+        return;
+    }
+    META_CONPRINTF("AMM Extension - Latency statistics, in microseconds (percentiles are bucket upper bounds)\n");
+    META_CONPRINTF("  %-34s %10s %10s %10s %10s %10s\n", "Native/operation", "Calls", "Avg", "p50", "p99", "Max");
+    for (const FMODLatencyHistogram *histogram : g_AdaptiveMusicExt.latencyHistograms) {
+        unsigned long long calls = histogram->calls.load(std::memory_order_relaxed);
+        if (calls == 0) {
+            continue;
+        }
+        META_CONPRINTF("  %-34s %10llu %10.2f %10.2f %10.2f %10.2f\n", histogram->name, calls,
+                       histogram->totalNanoseconds.load(std::memory_order_relaxed) / 1000.0 / calls,
+                       GetFMODLatencyPercentile(*histogram, calls, 0.5), GetFMODLatencyPercentile(*histogram, calls, 0.99),
+                       histogram->maxNanoseconds.load(std::memory_order_relaxed) / 1000.0);
+    }
+}
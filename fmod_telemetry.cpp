@@ -0,0 +1,160 @@
+#include "extension.h"
+
+ConVar amm_telemetry_interval("amm_telemetry_interval", "1000", FCVAR_NONE,
+                              "Time between two samples of the FMOD performance counters, in milliseconds",
+                              true, 100.0f, true, 60000.0f);
+ConVar amm_telemetry_log("amm_telemetry_log", "0", FCVAR_NONE,
+                         "Append each sample of the FMOD performance counters to logs/amm_telemetry.csv",
+                         true, 0.0f, true, 1.0f);
+ConVar amm_telemetry_log_size("amm_telemetry_log_size", "4096", FCVAR_NONE,
+                              "Size at which logs/amm_telemetry.csv is moved to logs/amm_telemetry.old.csv and started over, in kilobytes",
+                              true, 64.0f, true, 1048576.0f);
+
+/**
+ * Sample the performance counters of FMOD if amm_telemetry_interval went by, from the audio thread
+ * The buffer usage is reset after each sample, so its peaks and stalls cover a single interval
+ */
+void AdaptiveMusicExt::SampleFMODTelemetry() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - lastFMODTelemetrySample < std::chrono::milliseconds(amm_telemetry_interval.GetInt())) {
+        return;
+    }
+    lastFMODTelemetrySample = now;
+    FMODTelemetrySample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.sample = fmodTelemetry.sample + 1;
+    sample.time = std::chrono::duration<float>(now - fmodWorkerStart).count();
+    FMOD_STUDIO_CPU_USAGE studioCPUUsage;
+    FMOD_CPU_USAGE coreCPUUsage;
+    if (fmodStudioSystem->getCPUUsage(&studioCPUUsage, &coreCPUUsage) == FMOD_OK) {
+        sample.studioUpdateCPU = studioCPUUsage.update;
+        sample.coreUpdateCPU = coreCPUUsage.update;
+        sample.dspCPU = coreCPUUsage.dsp;
+        sample.streamCPU = coreCPUUsage.stream;
+    }
+    FMOD_STUDIO_BUFFER_USAGE bufferUsage;
+    if (fmodStudioSystem->getBufferUsage(&bufferUsage) == FMOD_OK) {
+        sample.commandQueue = bufferUsage.studiocommandqueue;
+        sample.handles = bufferUsage.studiohandle;
+        fmodStudioSystem->resetBufferUsage();
+    }
+    FMOD_STUDIO_MEMORY_USAGE memoryUsage;
+    if (fmodStudioSystem->getMemoryUsage(&memoryUsage) == FMOD_OK) {
+        sample.memoryExclusive = memoryUsage.exclusive;
+        sample.memoryInclusive = memoryUsage.inclusive;
+        sample.sampleDataBytes = memoryUsage.sampledata;
+    }
+    FMOD::System *fmodCoreSystem;
+    if (fmodStudioSystem->getCoreSystem(&fmodCoreSystem) == FMOD_OK) {
+        fmodCoreSystem->getFileUsage(&sample.sampleBytesRead, &sample.streamBytesRead, &sample.otherBytesRead);
+    }
+    fmodTelemetry = sample;
+}
+
+/**
+ * Helper function to quote a field of logs/amm_telemetry.csv, doubling the quotes it contains
+ */
+std::string QuoteFMODTelemetryField(const char *field) {
+    std::string quotedField = "\"";
+    for (const char *character = field; *character != '\0'; character++) {
+        if (*character == '"') {
+            quotedField += '"';
+        }
+        quotedField += *character;
+    }
+    quotedField += '"';
+    return quotedField;
+}
+
+/**
+ * Append the latest sample to logs/amm_telemetry.csv if it wasn't already, from the game frame
+ * The game time and tick are logged alongside, to line the samples up with what happened in game
+ */
+void AdaptiveMusicExt::WriteFMODTelemetryLog() {
+    FMODStateSnapshot snapshot = GetFMODStateSnapshot();
+    const FMODTelemetrySample &sample = snapshot.telemetry;
+    if (sample.sample == 0 || sample.sample == lastLoggedFMODTelemetrySample) {
+        return;
+    }
+    lastLoggedFMODTelemetrySample = sample.sample;
+    if (telemetryLogHandle != nullptr && telemetryLogSize >= (unsigned int) amm_telemetry_log_size.GetInt() * 1024) {
+        CloseFMODTelemetryLog();
+    }
+    if (telemetryLogHandle == nullptr) {
+        std::string logsFullPath = std::string(g_SMAPI->GetBaseDir()) + "/logs";
+        std::replace(logsFullPath.begin(), logsFullPath.end(), '\\', '/');
+        std::string logFullPath = logsFullPath + "/amm_telemetry.csv";
+        // The previous log is kept, whether it's from this session or an earlier one
+        filesystem->CreateDirHierarchy(logsFullPath.c_str());
+        AtomicReplaceFile(logFullPath, logsFullPath + "/amm_telemetry.old.csv");
+        telemetryLogHandle = filesystem->Open(logFullPath.c_str(), "wb");
+        if (telemetryLogHandle == nullptr) {
+            META_CONPRINTF("AMM Extension - Failed to open the telemetry log for writing, logging disabled: %s\n", logFullPath.c_str());
+            amm_telemetry_log.SetValue(0);
+            return;
+        }
+        const char *header = "game_time,game_tick,fmod_time,studio_update_cpu,core_update_cpu,dsp_cpu,stream_cpu,"
+                             "command_queue_peak,command_queue_capacity,command_queue_stalls,command_queue_stall_time,"
+                             "handle_peak,handle_capacity,handle_stalls,handle_stall_time,"
+                             "memory_exclusive,memory_inclusive,sample_data,sample_bytes_read,stream_bytes_read,other_bytes_read,"
+                             "started_event,timeline_position,paused\n";
+        telemetryLogSize = (unsigned int) filesystem->Write(header, (int) strlen(header), telemetryLogHandle);
+    }
+    std::string startedEventPath = QuoteFMODTelemetryField(snapshot.startedEventPath);
+    char line[1024];
+    int length = snprintf(line, sizeof(line),
+                          "%.3f,%d,%.3f,%.2f,%.2f,%.2f,%.2f,%d,%d,%d,%.4f,%d,%d,%d,%.4f,%d,%d,%d,%lld,%lld,%lld,%s,%d,%d\n",
+                          gpGlobals->curtime, gpGlobals->tickcount, sample.time,
+                          sample.studioUpdateCPU, sample.coreUpdateCPU, sample.dspCPU, sample.streamCPU,
+                          sample.commandQueue.peakusage, sample.commandQueue.capacity, sample.commandQueue.stallcount, sample.commandQueue.stalltime,
+                          sample.handles.peakusage, sample.handles.capacity, sample.handles.stallcount, sample.handles.stalltime,
+                          sample.memoryExclusive, sample.memoryInclusive, sample.sampleDataBytes,
+                          sample.sampleBytesRead, sample.streamBytesRead, sample.otherBytesRead,
+                          startedEventPath.c_str(), snapshot.timelinePosition, snapshot.paused ? 1 : 0);
+    if (length <= 0) {
+        return;
+    }
+    if (length >= (int) sizeof(line)) {
+        length = (int) sizeof(line) - 1;
+    }
+    telemetryLogSize += (unsigned int) filesystem->Write(line, length, telemetryLogHandle);
+    // A line a second at most, worth having it on disk if the game goes down
+    filesystem->Flush(telemetryLogHandle);
+}
+
+/**
+ * Close logs/amm_telemetry.csv if it's open, the next sample logged starts a new one
+ */
+void AdaptiveMusicExt::CloseFMODTelemetryLog() {
+    if (telemetryLogHandle == nullptr) {
+        return;
+    }
+    filesystem->Close(telemetryLogHandle);
+    telemetryLogHandle = nullptr;
+    telemetryLogSize = 0;
+}
+
+/**
+ * Print the latest sample of the FMOD performance counters
+ */
+CON_COMMAND(amm_telemetry, "Print the latest sample of the FMOD CPU, buffer, memory and file usage") {
+    FMODStateSnapshot snapshot = g_AdaptiveMusicExt.GetFMODStateSnapshot();
+    const FMODTelemetrySample &sample = snapshot.telemetry;
+    if (sample.sample == 0) {
+        META_CONPRINTF("AMM Extension - No FMOD telemetry was sampled yet\n");
+        return;
+    }
+    META_CONPRINTF("AMM Extension - FMOD telemetry, sampled %.1fs after the start of the audio thread\n", sample.time);
+    META_CONPRINTF("  CPU: studio update %.2f%%, core update %.2f%%, DSP %.2f%%, streams %.2f%%\n",
+                   sample.studioUpdateCPU, sample.coreUpdateCPU, sample.dspCPU, sample.streamCPU);
+    META_CONPRINTF("  Command queue: peak %d/%d bytes, %d stalls (%.4fs) over the last %dms\n",
+                   sample.commandQueue.peakusage, sample.commandQueue.capacity, sample.commandQueue.stallcount, sample.commandQueue.stalltime,
+                   amm_telemetry_interval.GetInt());
+    META_CONPRINTF("  Handles: peak %d/%d, %d stalls (%.4fs) over the last %dms\n",
+                   sample.handles.peakusage, sample.handles.capacity, sample.handles.stallcount, sample.handles.stalltime,
+                   amm_telemetry_interval.GetInt());
+    META_CONPRINTF("  Memory: %d bytes exclusive, %d bytes inclusive, %d bytes of sample data\n",
+                   sample.memoryExclusive, sample.memoryInclusive, sample.sampleDataBytes);
+    META_CONPRINTF("  File reads: %lld bytes of samples, %lld bytes of streams, %lld other bytes\n",
+                   sample.sampleBytesRead, sample.streamBytesRead, sample.otherBytesRead);
+}
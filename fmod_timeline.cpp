@@ -0,0 +1,94 @@
+#include "extension.h"
+
+/**
+ * FMOD event callback, records the timeline markers and beats of the started event
+ * FMOD calls it from a single thread of its own, the producer of the timeline ring
+ */
+FMOD_RESULT F_CALL FMODTimelineCallback(FMOD_STUDIO_EVENT_CALLBACK_TYPE type, FMOD_STUDIO_EVENTINSTANCE *event, void *parameters) {
+    FMOD::Studio::EventInstance *eventInstance = (FMOD::Studio::EventInstance *) event;
+    void *userData = nullptr;
+    if (eventInstance->getUserData(&userData) != FMOD_OK) {
+        return FMOD_OK;
+    }
+    FMODTimelineRecord record;
+    record.eventHandle = (int) (intptr_t) userData;
+    record.bar = 0;
+    record.beat = 0;
+    record.tempo = 0.0f;
+    record.timeSignatureUpper = 0;
+    record.timeSignatureLower = 0;
+    record.markerName[0] = '\0';
+    if (type == FMOD_STUDIO_EVENT_CALLBACK_TIMELINE_MARKER) {
+        FMOD_STUDIO_TIMELINE_MARKER_PROPERTIES *marker = (FMOD_STUDIO_TIMELINE_MARKER_PROPERTIES *) parameters;
+        record.type = FMODTimeline_Marker;
+        record.position = marker->position;
+        strncpy(record.markerName, marker->name, FMOD_TIMELINE_MARKER_NAME_SIZE - 1);
+        record.markerName[FMOD_TIMELINE_MARKER_NAME_SIZE - 1] = '\0';
+    } else if (type == FMOD_STUDIO_EVENT_CALLBACK_TIMELINE_BEAT) {
+        FMOD_STUDIO_TIMELINE_BEAT_PROPERTIES *beat = (FMOD_STUDIO_TIMELINE_BEAT_PROPERTIES *) parameters;
+        record.type = FMODTimeline_Beat;
+        record.position = beat->position;
+        record.bar = beat->bar;
+        record.beat = beat->beat;
+        record.tempo = beat->tempo;
+        record.timeSignatureUpper = beat->timesignatureupper;
+        record.timeSignatureLower = beat->timesignaturelower;
+    } else {
+        return FMOD_OK;
+    }
+    if (!g_AdaptiveMusicExt.fmodTimelineRing.Push(record)) {
+        g_AdaptiveMusicExt.droppedFMODTimelineRecords++;
+    }
+    return FMOD_OK;
+}
+
+/**
+ * Have the timeline markers and beats of an event instance forwarded to the plugins
+ * @param eventInstance The freshly created event instance
+ * @param eventHandle The handle of its FMOD Event, from GetFMODEventHandle
+ */
+void AdaptiveMusicExt::SetFMODTimelineCallbacks(FMOD::Studio::EventInstance *eventInstance, int eventHandle) {
+    FMOD_RESULT result;
+    result = eventInstance->setUserData((void *) (intptr_t) eventHandle);
+    if (result == FMOD_OK) {
+        result = eventInstance->setCallback(FMODTimelineCallback, FMOD_STUDIO_EVENT_CALLBACK_TIMELINE_MARKER | FMOD_STUDIO_EVENT_CALLBACK_TIMELINE_BEAT);
+    }
+    if (result != FMOD_OK) {
+        LogFMODMessage("AMM Extension - Could not follow the timeline of Event (%s). Error: (%d) %s\n", fmodEvents[eventHandle].path.c_str(), result,
+                       FMOD_ErrorString(result));
+    }
+}
+
+/**
+ * Fire OnFMODTimelineMarker and OnFMODBeat for the markers and beats reached since the last game frame, in order
+ */
+void AdaptiveMusicExt::FireFMODTimelineRecords() {
+    FMODTimelineRecord record;
+    while (fmodTimelineRing.Pop(record)) {
+        if (record.eventHandle != timelineEventHandle) {
+            // Paths never change for a handle, the registry is only looked at when the event changes
+            std::lock_guard<std::mutex> lock(fmodRegistryMutex);
+            timelineEventHandle = record.eventHandle;
+            timelineEventPath = fmodEventRegistry[record.eventHandle].path;
+        }
+        if (record.type == FMODTimeline_Marker) {
+            timelineMarkerForward->PushString(timelineEventPath.c_str());
+            timelineMarkerForward->PushString(record.markerName);
+            timelineMarkerForward->PushCell(record.position);
+            timelineMarkerForward->Execute(NULL);
+        } else {
+            beatForward->PushString(timelineEventPath.c_str());
+            beatForward->PushCell(record.bar);
+            beatForward->PushCell(record.beat);
+            beatForward->PushCell(record.position);
+            beatForward->PushFloat(record.tempo);
+            beatForward->PushCell(record.timeSignatureUpper);
+            beatForward->PushCell(record.timeSignatureLower);
+            beatForward->Execute(NULL);
+        }
+    }
+    unsigned int droppedRecords = droppedFMODTimelineRecords.exchange(0);
+    if (droppedRecords > 0) {
+        META_CONPRINTF("AMM Extension - %u timeline markers and beats were dropped, the game frame didn't keep up\n", droppedRecords);
+    }
+}
@@ -0,0 +1,255 @@
+#include "extension.h"
+
+#include <stdarg.h>
+#include <type_traits>
+
+thread_local bool onFMODWorkerThread = false; // Only set on the audio thread, its console lines go through the game frame
+
+ConVar amm_worker_interval("amm_worker_interval", "10", FCVAR_NONE,
+                           "Time between two updates of the FMOD audio thread, in milliseconds",
+                           true, 1.0f, true, 100.0f);
+
+/**
+ * Start the audio thread, which owns the FMOD Studio System from then on
+ * Must be called once the FMOD Studio System is initialized
+ */
+void AdaptiveMusicExt::StartFMODWorker() {
+    fmodSnapshotSequence = 0;
+    fmodSnapshotUpdate = 0;
+    memset(&fmodTelemetry, 0, sizeof(fmodTelemetry));
+    fmodWorkerStart = std::chrono::steady_clock::now();
+    checkedFMODParameterCount = 0;
+    checkedFMODMixerCount = 0;
+    lastFMODTelemetrySample = fmodWorkerStart;
+    residentFMODBanksChanged = true;
+    {
+        std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+        SyncFMODRegistryEntries();
+    }
+    PublishFMODRegistry();
+    PublishFMODStateSnapshot();
+    fmodWorkerRunning = true;
+    fmodWorkerThread = std::thread(&AdaptiveMusicExt::RunFMODWorker, this);
+}
+
+/**
+ * Stop the audio thread, FMOD can then be used from the game thread again to release it
+ */
+void AdaptiveMusicExt::StopFMODWorker() {
+    if (!fmodWorkerThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(fmodWorkerWakeMutex);
+        fmodWorkerRunning = false;
+    }
+    fmodWorkerWake.notify_all();
+    fmodWorkerThread.join();
+    // Nobody is left to fire the forwards, the console lines still get printed
+    FMODNotification notification;
+    while (fmodNotificationRing.Pop(notification)) {
+        if (notification.type == FMODNotification_Log) {
+            META_CONPRINTF("%s", notification.name.c_str());
+        }
+    }
+    for (const FMODNotification &overflowNotification : overflowFMODNotifications) {
+        if (overflowNotification.type == FMODNotification_Log) {
+            META_CONPRINTF("%s", overflowNotification.name.c_str());
+        }
+    }
+    overflowFMODNotifications.clear();
+}
+
+/**
+ * Body of the audio thread, updates FMOD at a fixed interval until it's stopped
+ */
+void AdaptiveMusicExt::RunFMODWorker() {
+    onFMODWorkerThread = true;
+    std::unique_lock<std::mutex> wakeLock(fmodWorkerWakeMutex);
+    while (fmodWorkerRunning) {
+        wakeLock.unlock();
+        UpdateFMODWorker();
+        wakeLock.lock();
+        fmodWorkerWake.wait_for(wakeLock, std::chrono::milliseconds(amm_worker_interval.GetInt()), [this] { return !fmodWorkerRunning; });
+    }
+}
+
+/**
+ * A single update of the audio thread: everything the natives asked for since the last one goes through a single FMOD update
+ * No lock is held during the FMOD calls, the natives only ever wait for the brief copies to and from the registries
+ */
+void AdaptiveMusicExt::UpdateFMODWorker() {
+    AMM_TIME_SCOPE("Audio thread update");
+    ResolveNewFMODRegistryEntries();
+    ExecuteQueuedFMODCommands();
+    if (!fadingFMODMixers.empty()) {
+        UpdateFMODMixerFades();
+    }
+    if (!activeFMODParameterRamps.empty()) {
+        UpdateFMODParameterRamps();
+    }
+    if (fmodOutputMode == FMODOutput_NoSoundNRT) {
+        // Each update mixes a single block, as many are made as the real time calls for
+        for (int blocks = GetDueFMODMixBlocks(); blocks > 0; blocks--) {
+            fmodStudioSystem->update();
+        }
+    } else {
+        fmodStudioSystem->update();
+    }
+    // An event can be left queued when the bank loads it waited for are cancelled
+    if (!pendingFMODBankLoads.empty() || queuedFMODEventHandle != -1) {
+        PollPendingFMODBankLoads();
+    }
+    if (!pendingFMODEventPrefetches.empty()) {
+        PollPendingFMODEventPrefetches();
+    }
+    if (!pendingFMODBankMemoryReleases.empty()) {
+        PollPendingFMODBankMemoryReleases();
+    }
+    // Notifications the game thread couldn't take yet go first, so the forwards keep their order
+    while (!overflowFMODNotifications.empty() && fmodNotificationRing.Push(overflowFMODNotifications.front())) {
+        overflowFMODNotifications.pop_front();
+    }
+    SampleFMODTelemetry();
+    PublishFMODRegistry();
+    PublishFMODStateSnapshot();
+}
+
+/**
+ * Copy what the audio thread knows about the registered names to the registries, for the natives reading them
+ */
+void AdaptiveMusicExt::PublishFMODRegistry() {
+    std::lock_guard<std::mutex> registryLock(fmodRegistryMutex);
+    for (size_t i = 0; i < fmodEvents.size(); i++) {
+        fmodEventRegistry[i].prefetchState = fmodEvents[i].prefetchState;
+    }
+    for (size_t i = 0; i < fmodParameters.size(); i++) {
+        fmodParameterRegistry[i].resolved = fmodParameters[i].resolved && fmodParameters[i].valueApplied;
+        fmodParameterRegistry[i].value = fmodParameters[i].value;
+    }
+    for (size_t i = 0; i < fmodMixers.size(); i++) {
+        fmodMixerRegistry[i].volume = fmodMixers[i].volume;
+    }
+    if (residentFMODBanksChanged) {
+        publishedResidentFMODBanks.clear();
+        for (const FMODBankResidency &residency : residentFMODBanks) {
+            publishedResidentFMODBanks.push_back(residency.bankName);
+        }
+        publishedLoadedFMODBankName = loadedFMODStudioBankName;
+        residentFMODBanksChanged = false;
+    }
+}
+
+/**
+ * Tell the game thread about a completed operation, from the audio thread
+ * @param type What completed
+ * @param name The bank name or event path
+ * @param error The error code (or 0 if no error was encountered)
+ */
+void AdaptiveMusicExt::PushFMODNotification(FMODNotificationType type, const std::string &name, int error) {
+    FMODNotification notification;
+    notification.type = type;
+    notification.name = name;
+    notification.error = error;
+    if (!overflowFMODNotifications.empty() || !fmodNotificationRing.Push(notification)) {
+        overflowFMODNotifications.push_back(notification);
+    }
+}
+
+/**
+ * Print a line to the console, or have the game frame print it when called from the audio thread
+ * The engine console isn't thread-safe, the lines of the audio thread keep their order with its other notifications
+ * @param format The printf-like format of the line, with its trailing newline
+ */
+void AdaptiveMusicExt::LogFMODMessage(const char *format, ...) {
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (onFMODWorkerThread) {
+        PushFMODNotification(FMODNotification_Log, message, 0);
+        return;
+    }
+    META_CONPRINTF("%s", message);
+}
+
+/**
+ * Fire the forwards of the operations the audio thread completed, from the game frame
+ * Plugins may call natives from the forwards, the audio thread isn't held by them
+ */
+void AdaptiveMusicExt::FireFMODNotifications() {
+    FMODNotification notification;
+    while (fmodNotificationRing.Pop(notification)) {
+        if (notification.type == FMODNotification_Log) {
+            META_CONPRINTF("%s", notification.name.c_str());
+            continue;
+        }
+        IForward *forward = notification.type == FMODNotification_BankLoaded ? bankLoadedForward : eventPrefetchedForward;
+        forward->PushString(notification.name.c_str());
+        forward->PushCell(notification.error);
+        forward->Execute(NULL);
+    }
+}
+
+/**
+ * Publish the state of the playback for the game thread, from the audio thread
+ * A sequence number guards the copy, readers retry while it's odd or changed under them
+ */
+void AdaptiveMusicExt::PublishFMODStateSnapshot() {
+    static_assert(std::is_trivially_copyable<FMODStateSnapshot>::value, "The snapshot is copied as words of memory");
+    FMODStateSnapshot snapshot;
+    snapshot.update = ++fmodSnapshotUpdate;
+    snapshot.startedEventHandle = startedFMODEventHandle;
+    strncpy(snapshot.startedEventPath, startedFMODStudioEventPath.c_str(), FMOD_SNAPSHOT_EVENT_PATH_SIZE - 1);
+    snapshot.startedEventPath[FMOD_SNAPSHOT_EVENT_PATH_SIZE - 1] = '\0';
+    snapshot.timelinePosition = -1;
+    snapshot.playbackState = FMOD_STUDIO_PLAYBACK_STOPPED;
+    if (createdFMODStudioEventInstance != nullptr) {
+        // The only FMOD calls made for the snapshot, however many times the plugins read it
+        int timelinePosition;
+        if (createdFMODStudioEventInstance->getTimelinePosition(&timelinePosition) == FMOD_OK) {
+            snapshot.timelinePosition = timelinePosition;
+        }
+        FMOD_STUDIO_PLAYBACK_STATE playbackState;
+        if (createdFMODStudioEventInstance->getPlaybackState(&playbackState) == FMOD_OK) {
+            snapshot.playbackState = playbackState;
+        }
+    }
+    snapshot.paused = knownFMODPausedState;
+    snapshot.volume = fmodMixers[masterBusHandle].volume;
+    snapshot.residentBanks = (int) residentFMODBanks.size();
+    snapshot.pendingBankLoads = (int) pendingFMODBankLoads.size();
+    snapshot.pendingEventPrefetches = (int) pendingFMODEventPrefetches.size();
+    snapshot.telemetry = fmodTelemetry;
+
+    unsigned int words[FMOD_SNAPSHOT_WORDS] = {};
+    memcpy(words, &snapshot, sizeof(snapshot));
+    unsigned int sequence = fmodSnapshotSequence.load(std::memory_order_relaxed);
+    fmodSnapshotSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < FMOD_SNAPSHOT_WORDS; i++) {
+        fmodSnapshotWords[i].store(words[i], std::memory_order_relaxed);
+    }
+    fmodSnapshotSequence.store(sequence + 2, std::memory_order_release);
+}
+
+/**
+ * Read the state of the playback as last published by the audio thread, without waiting for it
+ * @return A consistent copy of the snapshot
+ */
+FMODStateSnapshot AdaptiveMusicExt::GetFMODStateSnapshot() {
+    unsigned int words[FMOD_SNAPSHOT_WORDS];
+    unsigned int sequenceBefore, sequenceAfter;
+    do {
+        sequenceBefore = fmodSnapshotSequence.load(std::memory_order_acquire);
+        for (size_t i = 0; i < FMOD_SNAPSHOT_WORDS; i++) {
+            words[i] = fmodSnapshotWords[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        sequenceAfter = fmodSnapshotSequence.load(std::memory_order_relaxed);
+    } while ((sequenceBefore & 1) != 0 || sequenceBefore != sequenceAfter);
+    FMODStateSnapshot snapshot;
+    memcpy(&snapshot, words, sizeof(snapshot));
+    return snapshot;
+}